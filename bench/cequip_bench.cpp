@@ -0,0 +1,552 @@
+// Benchmark suite: generates synthetic header libraries, preprocesses them through the same
+// preprocess() path as the command line tool and reports per-phase timings as JSON.
+
+#include "internal/cli.hpp"
+#include "internal/common.hpp"
+#include "internal/file_system.hpp"
+#include "internal/output.hpp"
+#include "internal/preprocess.hpp"
+#include "internal/report.hpp"
+
+#include <spdlog/sinks/stdout_sinks.h>
+#include <spdlog/spdlog.h>
+
+#include <CLI/CLI.hpp>
+#include <boost/filesystem.hpp>
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <numeric>
+#include <string>
+#include <vector>
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace cequip::internal {
+
+namespace {
+
+struct bench_config {
+    unsigned int iterations;
+    unsigned int scale;
+    std::string output_file_raw;
+    std::string work_dir_raw;
+    std::vector<std::string> workloads;
+    bool keep_files;
+    bool no_pass_through;
+    bool prefetch;
+    bool cold;
+};
+
+struct workload {
+    std::string name;
+    std::string description;
+    std::function<void(const boost::filesystem::path&, unsigned int)> generate;
+    bool remove_comments = false;
+    eol_type eol = eol_type::as_is;
+};
+
+struct phase_samples {
+    std::vector<double> total, load, resolve, lex_expand, write;
+};
+
+bool write_file(const boost::filesystem::path& path, const std::string& contents) {
+    boost::system::error_code ec;
+    boost::filesystem::create_directories(path.parent_path(), ec);
+    std::ofstream file(path.string(), std::ios::binary);
+    file << contents;
+    if (!file) {
+        spdlog::error("Failed to write generated file: {}", path.string());
+        return false;
+    }
+    return true;
+}
+
+std::string guard_name(const std::string& stem) {
+    std::string guard = "BENCH_" + stem + "_HPP";
+    std::transform(guard.begin(), guard.end(), guard.begin(),
+                   [](unsigned char ch) { return std::isalnum(ch) ? std::toupper(ch) : '_'; });
+    return guard;
+}
+
+std::string declarations(const std::string& prefix, unsigned int count) {
+    std::string text;
+    for (unsigned int i = 0; i < count; ++i) {
+        text += fmt::format("struct {0}_type_{1} {{ int value = {1}; }};\n", prefix, i);
+        text += fmt::format("inline int {0}_func_{1}(int x) {{ return x * {1} + 1; }}\n", prefix,
+                            i);
+    }
+    return text;
+}
+
+// Every workload writes main.cpp into the root directory and its headers into root/inc, which
+// is passed as the include path.
+void generate_deep_chain(const boost::filesystem::path& root, unsigned int scale) {
+    const unsigned int depth = 100 * scale;
+    for (unsigned int i = 0; i < depth; ++i) {
+        const auto stem = fmt::format("chain_{}", i);
+        std::string text = fmt::format("#ifndef {0}\n#define {0}\n", guard_name(stem));
+        if (i + 1 < depth) {
+            text += fmt::format("#include \"chain_{}.hpp\"\n", i + 1);
+        }
+        text += declarations(stem, 10) + "#endif\n";
+        write_file(root / "inc" / (stem + ".hpp"), text);
+    }
+    write_file(root / "main.cpp", "#include <chain_0.hpp>\nint main() { return 0; }\n");
+}
+
+void generate_wide_fanout(const boost::filesystem::path& root, unsigned int scale) {
+    const unsigned int width = 400 * scale;
+    std::string main_text;
+    for (unsigned int i = 0; i < width; ++i) {
+        const auto stem = fmt::format("leaf_{}", i);
+        const auto relative = fmt::format("group_{}/{}.hpp", i / 20, stem);
+        write_file(root / "inc" / relative,
+                   fmt::format("#pragma once\n#include <vector>\n{}", declarations(stem, 5)));
+        main_text += fmt::format("#include <{}>\n", relative);
+    }
+    write_file(root / "main.cpp", main_text + "int main() { return 0; }\n");
+}
+
+// Header i includes all headers before it, so most includes hit an include guard or a
+// #pragma once that was already seen.
+void generate_guard_heavy(const boost::filesystem::path& root, unsigned int scale) {
+    const unsigned int count = 150 * scale;
+    for (unsigned int i = 0; i < count; ++i) {
+        const auto stem = fmt::format("guarded_{}", i);
+        std::string includes;
+        for (unsigned int j = 0; j < i; ++j) {
+            includes += fmt::format("#include \"guarded_{}.hpp\"\n", j);
+        }
+        const auto body = includes + declarations(stem, 2);
+        write_file(root / "inc" / (stem + ".hpp"),
+                   i % 2 == 0 ? fmt::format("#ifndef {0}\n#define {0}\n{1}#endif\n",
+                                            guard_name(stem), body)
+                              : "#pragma once\n" + body);
+    }
+    write_file(root / "main.cpp",
+               fmt::format("#include <guarded_{}.hpp>\nint main() {{ return 0; }}\n", count - 1));
+}
+
+// cequip keeps macros unexpanded in the output, so the expansions sit in #if conditions.
+void generate_macro_heavy(const boost::filesystem::path& root, unsigned int scale) {
+    const unsigned int count = 40 * scale;
+    std::string main_text;
+    for (unsigned int i = 0; i < count; ++i) {
+        const auto stem = fmt::format("macros_{}", i);
+        std::string text = fmt::format("#ifndef {0}\n#define {0}\n", guard_name(stem));
+        text += fmt::format("#define M{}_0(x) (x)\n", i);
+        for (unsigned int j = 1; j < 30; ++j) {
+            text += fmt::format("#define M{0}_{1}(x) (M{0}_{2}(x) * {1} + MCAT(k, {1}))\n", i, j,
+                                j - 1);
+        }
+        for (unsigned int j = 0; j < 30; ++j) {
+            text += fmt::format("#if M{0}_{1}({1}) >= {1}\nint value_{0}_{1} = {1};\n#endif\n", i,
+                                j);
+        }
+        text += fmt::format("#define N{0}_1 M{0}_1(1)\n", i);
+        for (unsigned int j = 2; j <= 8; ++j) {
+            text += fmt::format("#define N{0}_{1} M{0}_2(N{0}_{2})\n", i, j, j - 1);
+        }
+        text += fmt::format("#if N{0}_8 > 0\nint nested_{0} = 1;\n#endif\n#endif\n", i);
+        write_file(root / "inc" / (stem + ".hpp"), text);
+        main_text += fmt::format("#include \"{}.hpp\"\n", stem);
+    }
+    write_file(root / "main.cpp",
+               "#define MCAT_(a, b) a##b\n#define MCAT(a, b) MCAT_(a, b)\n" + main_text +
+                   "int main() { return 0; }\n");
+}
+
+void generate_comment_heavy(const boost::filesystem::path& root, unsigned int scale) {
+    const unsigned int count = 50 * scale;
+    std::string main_text;
+    for (unsigned int i = 0; i < count; ++i) {
+        const auto stem = fmt::format("documented_{}", i);
+        std::string text = fmt::format("#ifndef {0}\n#define {0}\n", guard_name(stem));
+        for (unsigned int j = 0; j < 10; ++j) {
+            text += "/**\n";
+            for (unsigned int line = 0; line < 20; ++line) {
+                text += fmt::format(" * Paragraph {} line {} of the documentation for {}.\n", j,
+                                    line, stem);
+            }
+            text += " */\n";
+            text += fmt::format("int {0}_value_{1}; // trailing comment on value {1}\n", stem, j);
+        }
+        text += "#endif\n";
+        write_file(root / "inc" / (stem + ".hpp"), text);
+        main_text += fmt::format("#include \"{}.hpp\"\n", stem);
+    }
+    write_file(root / "main.cpp", main_text + "int main() { return 0; }\n");
+}
+
+void generate_crlf(const boost::filesystem::path& root, unsigned int scale) {
+    const unsigned int count = 50 * scale;
+    const auto to_crlf = [](const std::string& text) {
+        std::string result;
+        for (const char ch : text) {
+            if (ch == '\n') {
+                result += '\r';
+            }
+            result += ch;
+        }
+        return result;
+    };
+    std::string main_text;
+    for (unsigned int i = 0; i < count; ++i) {
+        const auto stem = fmt::format("crlf_{}", i);
+        write_file(root / "inc" / (stem + ".hpp"),
+                   to_crlf(fmt::format("#ifndef {0}\n#define {0}\n{1}#endif\n", guard_name(stem),
+                                       declarations(stem, 20))));
+        main_text += fmt::format("#include \"{}.hpp\"\n", stem);
+    }
+    write_file(root / "main.cpp", to_crlf(main_text + "int main() { return 0; }\n"));
+}
+
+std::vector<workload> make_workloads() {
+    std::vector<workload> workloads;
+    workloads.push_back({"deep_chain", "long chain of nested guarded includes",
+                         generate_deep_chain});
+    workloads.push_back({"wide_fanout", "hundreds of <...> includes spread over subdirectories",
+                         generate_wide_fanout});
+    workloads.push_back({"guard_heavy", "repeated includes of guarded and #pragma once headers",
+                         generate_guard_heavy});
+    workloads.push_back({"macro_heavy", "deeply nested function-like macro expansions",
+                         generate_macro_heavy});
+    workloads.push_back({"comment_heavy", "large comment blocks run with --remove-comments",
+                         generate_comment_heavy, true});
+    workloads.push_back({"crlf", "CRLF inputs run with --end-of-line lf", generate_crlf, false,
+                         eol_type::lf});
+    return workloads;
+}
+
+double to_ms(std::chrono::nanoseconds duration) {
+    return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+std::string summary_json(std::vector<double> samples) {
+    std::sort(samples.begin(), samples.end());
+    const auto mean = std::accumulate(samples.begin(), samples.end(), 0.0) / samples.size();
+    const auto middle = samples.size() / 2;
+    const auto median = samples.size() % 2 != 0
+                            ? samples[middle]
+                            : (samples[middle - 1] + samples[middle]) / 2;
+    return fmt::format(R"({{"min_ms": {:.3f}, "median_ms": {:.3f}, "mean_ms": {:.3f}}})",
+                       samples.front(), median, mean);
+}
+
+std::uintmax_t directory_bytes(const boost::filesystem::path& root, std::size_t& file_count) {
+    std::uintmax_t bytes = 0;
+    boost::system::error_code ec;
+    for (boost::filesystem::recursive_directory_iterator it(root, ec), end; !ec && it != end;
+         it.increment(ec)) {
+        if (boost::filesystem::is_regular_file(it->status())) {
+            bytes += boost::filesystem::file_size(it->path(), ec);
+            ++file_count;
+        }
+    }
+    return bytes;
+}
+
+// Drops the files below root from the page cache, so that the next run reads them from disk.
+bool evict_page_cache(const boost::filesystem::path& root) {
+#if defined(__linux__)
+    boost::system::error_code ec;
+    for (boost::filesystem::recursive_directory_iterator it(root, ec), end; !ec && it != end;
+         it.increment(ec)) {
+        if (!boost::filesystem::is_regular_file(it->status())) {
+            continue;
+        }
+        const int fd = ::open(it->path().c_str(), O_RDONLY);
+        if (fd < 0) {
+            continue;
+        }
+        // Dirty pages stay cached, so freshly generated files are written back first.
+        ::fdatasync(fd);
+        ::posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        ::close(fd);
+    }
+    return true;
+#else
+    spdlog::error("--cold is only supported on Linux");
+    return false;
+#endif
+}
+
+bool run_workload(const bench_config& bench, const workload& load,
+                  const boost::filesystem::path& root, std::string& json) {
+    const auto input_dir = root / "input";
+    boost::system::error_code ec;
+    boost::filesystem::remove_all(input_dir, ec);
+    load.generate(input_dir, bench.scale);
+    std::size_t file_count = 0;
+    const auto input_bytes = directory_bytes(input_dir, file_count);
+
+    run_config config{};
+    config.lang = parse_language("cpp23");
+    config.remove_comments = load.remove_comments;
+    config.eol = load.eol;
+    config.no_pass_through = bench.no_pass_through;
+    config.include_paths_raw = {(input_dir / "inc").string()};
+
+    shared_setup setup;
+    if (!resolve_include_paths(config.include_paths_raw, setup.include_paths)) {
+        return false;
+    }
+    setup.predefined_macros = make_predefined_macros(config);
+    std::optional<prefetch_pool> prefetch;
+    if (bench.prefetch) {
+        prefetch.emplace(std::clamp<std::size_t>(std::thread::hardware_concurrency(), 2, 8));
+        setup.prefetch = &*prefetch;
+    }
+
+    const auto main_path = input_dir / "main.cpp";
+    const auto output_file_raw = (root / "output.cpp").string();
+    phase_samples samples;
+    std::uintmax_t output_bytes = 0;
+    spdlog::set_level(spdlog::level::warn);
+    // The first run only warms up the page cache (or, with --cold, the rest) and is not
+    // reported.
+    for (unsigned int iteration = 0; iteration <= bench.iterations; ++iteration) {
+        if (bench.cold && !evict_page_cache(input_dir)) {
+            return false;
+        }
+        include_index includes;
+        setup.includes = &includes;
+        phase_timings timings;
+        const auto start = std::chrono::steady_clock::now();
+
+        file_buffer contents;
+        output_sink sink;
+        sink.timings = &timings;
+        {
+            phase_timer timer(&timings, &phase_timings::load);
+            if (!load_file_contents(main_path, contents)) {
+                return false;
+            }
+        }
+        {
+            phase_timer timer(&timings, &phase_timings::write);
+            if (!sink.open(output_file_raw)) {
+                return false;
+            }
+        }
+        output_buffer result(sink);
+        if (!preprocess(config, main_path, setup, contents.view(), result, nullptr, &timings) ||
+            !write_output(output_file_raw, sink, result)) {
+            spdlog::error("Workload {} failed to preprocess", load.name);
+            return false;
+        }
+        const std::chrono::nanoseconds total = std::chrono::steady_clock::now() - start;
+        output_bytes = result.size();
+        if (iteration == 0) {
+            continue;
+        }
+
+        samples.total.push_back(to_ms(total));
+        samples.load.push_back(to_ms(timings.load));
+        samples.resolve.push_back(to_ms(timings.resolve));
+        samples.write.push_back(to_ms(timings.write));
+        samples.lex_expand.push_back(
+            to_ms(total - timings.load - timings.resolve - timings.write));
+    }
+
+    json += fmt::format(
+        R"(    {{
+      "name": "{}",
+      "description": "{}",
+      "files": {},
+      "input_bytes": {},
+      "output_bytes": {},
+      "phases": {{
+        "total": {},
+        "load": {},
+        "resolve": {},
+        "lex_expand": {},
+        "write": {}
+      }}
+    }})",
+        load.name, load.description, file_count, input_bytes, output_bytes,
+        summary_json(samples.total), summary_json(samples.load), summary_json(samples.resolve),
+        summary_json(samples.lex_expand), summary_json(samples.write));
+
+    spdlog::set_level(spdlog::level::info);
+    std::sort(samples.total.begin(), samples.total.end());
+    spdlog::info("{:<14} {:>5} files {:>10} bytes  median {:>9.2f} ms", load.name, file_count,
+                 input_bytes, samples.total[samples.total.size() / 2]);
+    return true;
+}
+
+bench_config parse_bench_cli(int argc, char** argv) {
+    bench_config bench;
+    CLI::App app("Synthetic workload benchmarks for cequip");
+
+    app.add_option("-n,--iterations", bench.iterations, "Measured runs per workload")
+        ->default_val(5)
+        ->check(CLI::PositiveNumber);
+    app.add_option("-s,--scale", bench.scale, "Size multiplier of the generated workloads")
+        ->default_val(1)
+        ->check(CLI::PositiveNumber);
+    app.add_option("-o,--output", bench.output_file_raw, "JSON results file")
+        ->default_val("stdout");
+    app.add_option("--work-dir", bench.work_dir_raw,
+                   "Directory for generated inputs (default: a new temporary directory)");
+    app.add_option("-w,--workload", bench.workloads, "Run only the named workloads");
+    app.add_flag("--keep-files", bench.keep_files, "Keep the generated inputs after the run");
+    app.add_flag("--no-pass-through", bench.no_pass_through,
+                 "Lex every line with Wave, to compare against the raw pass-through");
+    app.add_flag("--prefetch", bench.prefetch,
+                 "Read included files ahead on worker threads, to compare against reading them "
+                 "when Wave reaches them");
+    app.add_flag("--cold", bench.cold,
+                 "Drop the inputs from the page cache before every run (Linux only)");
+
+    try {
+        app.parse(argc, argv);
+    } catch (const CLI::ParseError& e) {
+        std::exit(app.exit(e));
+    }
+    return bench;
+}
+
+// Case-insensitive search for each license keyword in turn, as comments were matched before
+// keyword_matcher.
+bool contains_license_keyword(std::string_view value) {
+    const auto contains = [&](std::string_view lowercase) {
+        return std::search(value.begin(), value.end(), lowercase.begin(), lowercase.end(),
+                           [](char ch, char lower) {
+                               return std::tolower(static_cast<unsigned char>(ch)) == lower;
+                           }) != value.end();
+    };
+    return contains("copyright") || contains("license") || contains("(c)") ||
+           contains("all rights reserved") || contains("©") || contains("®");
+}
+
+// Times the comment retention check on generated comments, one search per keyword against the
+// single pass of keyword_matcher.
+bool run_comment_matcher(const bench_config& bench, std::string& json) {
+    std::vector<std::string> comments;
+    for (unsigned int i = 0; i < 2000 * bench.scale; ++i) {
+        if (i % 50 == 0) {
+            comments.push_back(fmt::format(
+                "/*\n * Copyright (C) {} The Authors. All Rights Reserved.\n * Licensed under "
+                "the MIT License.\n */",
+                2000 + i % 25));
+        } else if (i % 2 == 0) {
+            std::string comment = "/**\n";
+            for (unsigned int line = 0; line < 8; ++line) {
+                comment += fmt::format(" * Paragraph line {} of the documentation for item {}.\n",
+                                       line, i);
+            }
+            comments.push_back(comment + " */");
+        } else {
+            comments.push_back(fmt::format("// trailing comment on value {}", i));
+        }
+    }
+    std::size_t bytes = 0;
+    for (const auto& comment : comments) {
+        bytes += comment.size();
+    }
+
+    const auto& matcher = keyword_matcher::license_keywords();
+    for (const auto& comment : comments) {
+        if (matcher.matches(comment) != contains_license_keyword(comment)) {
+            spdlog::error("keyword_matcher disagrees with the keyword search on '{}'", comment);
+            return false;
+        }
+    }
+
+    const auto time = [&](const auto& matches) {
+        std::vector<double> samples;
+        std::size_t kept = 0;
+        for (unsigned int i = 0; i < bench.iterations; ++i) {
+            const auto begin = std::chrono::steady_clock::now();
+            for (const auto& comment : comments) {
+                kept += matches(comment) ? 1 : 0;
+            }
+            samples.push_back(to_ms(std::chrono::steady_clock::now() - begin));
+        }
+        return std::make_pair(summary_json(samples), kept);
+    };
+    const auto search = time([](std::string_view comment) {
+        return contains_license_keyword(comment);
+    });
+    const auto dfa = time([&](std::string_view comment) { return matcher.matches(comment); });
+    spdlog::info("comment_matcher: {} comments, {} bytes", comments.size(), bytes);
+
+    json += fmt::format(
+        "  \"comment_matcher\": {{\n    \"comments\": {},\n    \"bytes\": {},\n"
+        "    \"kept\": {},\n    \"keyword_search\": {},\n    \"keyword_matcher\": {}\n  }}",
+        comments.size(), bytes, dfa.second / bench.iterations, search.first, dfa.first);
+    return true;
+}
+
+int run_bench(int argc, char** argv) {
+    const auto bench = parse_bench_cli(argc, argv);
+    // Results go to stdout by default, so progress is reported on stderr.
+    spdlog::set_default_logger(spdlog::stderr_logger_mt("cequip_bench"));
+    spdlog::default_logger()->set_pattern("[%^%l%$] %v");
+
+    boost::system::error_code ec;
+    const auto root = bench.work_dir_raw.empty()
+                          ? boost::filesystem::temp_directory_path(ec) /
+                                boost::filesystem::unique_path("cequip-bench-%%%%-%%%%")
+                          : boost::filesystem::path(bench.work_dir_raw);
+    boost::filesystem::create_directories(root, ec);
+    if (ec) {
+        spdlog::error("Failed to create work directory '{}': {}", root.string(), ec.message());
+        return 1;
+    }
+
+    std::string json =
+        fmt::format("{{\n  \"version\": \"{}\",\n  \"iterations\": {},\n  \"scale\": {},\n"
+                    "  \"pass_through\": {},\n  \"prefetch\": {},\n  \"cold\": {},\n"
+                    "  \"workloads\": [\n",
+                    PROJECT_VERSION, bench.iterations, bench.scale, !bench.no_pass_through,
+                    bench.prefetch, bench.cold);
+    bool first = true;
+    bool success = true;
+    for (const auto& load : make_workloads()) {
+        if (!bench.workloads.empty() &&
+            std::find(bench.workloads.begin(), bench.workloads.end(), load.name) ==
+                bench.workloads.end()) {
+            continue;
+        }
+        if (!first) {
+            json += ",\n";
+        }
+        first = false;
+        if (!run_workload(bench, load, root, json)) {
+            success = false;
+            break;
+        }
+    }
+    json += "\n  ],\n";
+    if (success && !run_comment_matcher(bench, json)) {
+        success = false;
+    }
+    json += "\n}\n";
+
+    if (!bench.keep_files) {
+        boost::filesystem::remove_all(root, ec);
+    }
+    if (!success) {
+        return 1;
+    }
+
+    output_sink sink;
+    output_buffer result(sink);
+    if (!sink.open(bench.output_file_raw)) {
+        return 1;
+    }
+    result << json;
+    return write_output(bench.output_file_raw, sink, result) ? 0 : 1;
+}
+
+}  // namespace
+
+}  // namespace cequip::internal
+
+int main(int argc, char** argv) { return cequip::internal::run_bench(argc, argv); }
@@ -0,0 +1,201 @@
+#include "internal/batch.hpp"
+
+#include "internal/cache.hpp"
+#include "internal/file_system.hpp"
+#include "internal/output.hpp"
+#include "internal/report.hpp"
+
+#include <spdlog/spdlog.h>
+
+#include <boost/filesystem.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <utility>
+
+namespace cequip::internal {
+
+std::string depfile_path(const run_config& config, const batch_job& job) {
+    if (!config.depfile_raw.empty()) {
+        return config.depfile_raw;
+    }
+    return config.depfile_per_output ? job.output_file_raw + ".d" : std::string();
+}
+
+bool write_depfile(const std::string& depfile, const std::string& target,
+                   std::vector<std::string> dependencies) {
+    std::sort(dependencies.begin(), dependencies.end());
+    dependencies.erase(std::unique(dependencies.begin(), dependencies.end()), dependencies.end());
+    const auto escape = [](std::string_view file) {
+        std::string escaped;
+        for (const char ch : file) {
+            if (ch == ' ' || ch == '#') {
+                escaped += '\\';
+            } else if (ch == '$') {
+                escaped += '$';
+            }
+            escaped += ch;
+        }
+        return escaped;
+    };
+
+    output_sink sink;
+    if (!sink.open(depfile)) {
+        return false;
+    }
+    output_buffer result(sink);
+    result << escape(target) << ':';
+    for (const auto& file : dependencies) {
+        result << " \\\n  " << escape(file);
+    }
+    result << '\n';
+    return write_output(depfile, sink, result);
+}
+
+namespace {
+
+// Whether the output a record describes is still what a run would write: the output and the
+// depfile exist, the output is unchanged since, and so are all files and directories it was
+// built from.
+bool output_up_to_date(const header_cache& cache, std::uint64_t key, const std::string& output,
+                       const std::string& depfile) {
+    output_record record;
+    std::uint64_t hash;
+    if (!cache.load_record(key, record) || !hash_file(output, hash) ||
+        hash != record.output_hash) {
+        return false;
+    }
+    boost::system::error_code ec;
+    if (!depfile.empty() && !boost::filesystem::is_regular_file(depfile, ec)) {
+        return false;
+    }
+    for (const auto& [file, content_hash] : record.files) {
+        if (!hash_file(file, hash) || hash != content_hash) {
+            return false;
+        }
+    }
+    for (const auto& [dir, time] : record.directories) {
+        if (directory_time(dir) != time) {
+            return false;
+        }
+    }
+    return true;
+}
+
+}  // namespace
+
+bool process_job(const run_config& config, const batch_job& job, const shared_setup& setup,
+                 std::uintmax_t& input_bytes, bool stream_console) {
+    boost::filesystem::path path;
+    if (!resolve_input_path(job.input_file_raw, path)) {
+        return false;
+    }
+
+    const bool to_console = is_console(job.output_file_raw);
+    const auto depfile = depfile_path(config, job);
+    if (!depfile.empty() && to_console) {
+        spdlog::error("A depfile needs an output file: {}", path.string());
+        return false;
+    }
+
+    // An output whose inputs are all unchanged since it was written is left as it is, without
+    // preprocessing anything. Traces and size reports always want a real run.
+    const bool use_record =
+        setup.cache != nullptr && !to_console && setup.trace == nullptr && setup.sizes == nullptr;
+    const auto output_path = boost::filesystem::absolute(job.output_file_raw).string();
+    const auto record_key =
+        use_record ? setup.cache->make_record_key(path.string(), output_path,
+                                                  hash_combine(config.tree_shake,
+                                                               hash_bytes(depfile)))
+                   : 0;
+    if (use_record &&
+        output_up_to_date(*setup.cache, record_key, output_path, depfile)) {
+        spdlog::info("Up to date: {}", job.output_file_raw);
+        return true;
+    }
+
+    spdlog::info("Processing file: {}", path.string());
+    trace_span job_span(setup.trace, path.string(), "job");
+
+    file_buffer contents;
+    {
+        trace_span span(setup.trace, "load_file_contents", "io");
+        if (!load_file_contents(path, contents)) {
+            return false;
+        }
+    }
+    input_bytes = contents.view().size();
+
+    // Several jobs writing to the console at once would interleave, so they only stream into
+    // files and keep console output until their run is complete.
+    output_sink sink;
+    output_buffer result;
+    if (!to_console || stream_console) {
+        if (!sink.open(job.output_file_raw)) {
+            return false;
+        }
+        result.attach(sink);
+    }
+    std::vector<std::string> included_files;
+    output_record record;
+    phase_timings timings;
+    const bool preprocessed =
+        preprocess(config, path, setup, contents.view(), result, &included_files,
+                   setup.waits != nullptr ? &timings : nullptr, nullptr,
+                   use_record ? &record : nullptr);
+    if (setup.waits != nullptr) {
+        setup.waits->add(timings);
+    }
+    if (!preprocessed) {
+        return false;
+    }
+    {
+        trace_span span(setup.trace, "write_output", "io");
+        if (!write_output(job.output_file_raw, sink, result)) {
+            return false;
+        }
+    }
+    included_files.push_back(path.string());
+    if (!depfile.empty() && !write_depfile(depfile, job.output_file_raw, included_files)) {
+        return false;
+    }
+    if (use_record && !record.files.empty()) {
+        record.output_hash = sink.content_hash();
+        // Stamped only now, as writing the output may have changed one of them.
+        for (auto& [dir, time] : record.directories) {
+            time = directory_time(dir);
+        }
+        setup.cache->store_record(record_key, record);
+    }
+    return true;
+}
+
+bool run_batch(const run_config& config, const std::vector<batch_job>& jobs,
+               const shared_setup& setup) {
+    const auto start = std::chrono::steady_clock::now();
+    const std::size_t worker_count =
+        config.jobs != 0 ? config.jobs : std::max(1u, std::thread::hardware_concurrency());
+    work_stealing_pool pool(std::min(worker_count, jobs.size()));
+
+    std::atomic<std::size_t> failed_count = 0;
+    std::atomic<std::uintmax_t> total_bytes = 0;
+    pool.run(jobs.size(), [&](std::size_t index) {
+        std::uintmax_t input_bytes = 0;
+        if (!process_job(config, jobs[index], setup, input_bytes, false)) {
+            ++failed_count;
+        }
+        total_bytes += input_bytes;
+    });
+
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    const double seconds = std::max(elapsed.count(), 1e-9);
+    spdlog::info("Processed {} files ({} failed) with {} workers in {:.3f} s", jobs.size(),
+                 failed_count.load(), pool.size(), seconds);
+    spdlog::info("Throughput: {:.1f} files/s, {:.3f} ms/file, {:.2f} MiB/s input",
+                 jobs.size() / seconds, seconds * 1000.0 / jobs.size(),
+                 static_cast<double>(total_bytes.load()) / (1024.0 * 1024.0) / seconds);
+    return failed_count == 0;
+}
+
+}  // namespace cequip::internal
@@ -0,0 +1,288 @@
+#include "internal/cache.hpp"
+
+#include <spdlog/spdlog.h>
+
+#include <boost/filesystem.hpp>
+#include <algorithm>
+#include <cstdlib>
+
+namespace cequip::internal {
+
+namespace {
+
+// Roughly the heap memory entry takes up.
+std::size_t memory_size(const cached_header& entry) {
+    std::size_t size = sizeof(cached_header) + entry.text.size();
+    for (const auto& event : entry.events) {
+        size += sizeof(cache_event) + event.name.size() + event.value.size();
+        for (const auto* tokens : {&event.parameters, &event.definition}) {
+            for (const auto& tok : *tokens) {
+                size += sizeof(cached_token) + tok.value.size();
+            }
+        }
+    }
+    return size;
+}
+
+}  // namespace
+
+bool header_cache::remember(std::uint64_t key, const cached_header& entry) const {
+    const auto size = memory_size(entry);
+    if (memory.contains(key) || size > max_memory_bytes) {
+        return false;
+    }
+    while (memory_bytes + size > max_memory_bytes) {
+        const auto oldest = memory.find(memory_uses.back());
+        memory_bytes -= oldest->second.size;
+        memory.erase(oldest);
+        memory_uses.pop_back();
+    }
+    memory_uses.push_front(key);
+    memory.emplace(key, memory_entry{entry, size, memory_uses.begin()});
+    memory_bytes += size;
+    return true;
+}
+
+bool header_cache::load(std::uint64_t key, cached_header& entry) const {
+    {
+        std::scoped_lock lock(memory_mutex);
+        if (auto it = memory.find(key); it != memory.end()) {
+            memory_uses.splice(memory_uses.begin(), memory_uses, it->second.use);
+            entry = it->second.header;
+            return true;
+        }
+    }
+    if (dir.empty()) {
+        return false;
+    }
+    std::ifstream file(entry_path(key).string(), std::ios::binary);
+    if (!file.is_open()) {
+        return false;
+    }
+    const std::string data((std::istreambuf_iterator<char>(file)),
+                           std::istreambuf_iterator<char>());
+
+    cache_io::reader in{data};
+    if (in.string() != magic || in.u64() != key) {
+        return false;
+    }
+    entry.events = in.events();
+    entry.text = in.string();
+    if (!in.ok || !in.data.empty()) {
+        return false;
+    }
+    // The modification time doubles as the last use, which pruning goes by.
+    boost::system::error_code ec;
+    boost::filesystem::last_write_time(entry_path(key), std::time(nullptr), ec);
+    std::scoped_lock lock(memory_mutex);
+    remember(key, entry);
+    return true;
+}
+
+void header_cache::store(std::uint64_t key, const cached_header& entry) {
+    {
+        std::scoped_lock lock(memory_mutex);
+        if (!remember(key, entry)) {
+            return;
+        }
+    }
+    if (dir.empty()) {
+        ++stores;
+        return;
+    }
+    const auto path = entry_path(key);
+    boost::system::error_code ec;
+    if (boost::filesystem::exists(path, ec)) {
+        return;
+    }
+
+    std::string data;
+    cache_io::put_string(data, magic);
+    cache_io::put_u64(data, key);
+    cache_io::put_events(data, entry.events);
+    cache_io::put_string(data, entry.text);
+    if (write_file(key, data, path)) {
+        ++stores;
+    }
+}
+
+void header_cache::forget(std::uint64_t key) {
+    {
+        std::scoped_lock lock(memory_mutex);
+        if (auto it = memory.find(key); it != memory.end()) {
+            memory_bytes -= it->second.size;
+            memory_uses.erase(it->second.use);
+            memory.erase(it);
+        }
+    }
+    if (!dir.empty()) {
+        boost::system::error_code ec;
+        boost::filesystem::remove(entry_path(key), ec);
+    }
+}
+
+// Writes under a unique name and renames so concurrent runs never observe a partial file.
+bool header_cache::write_file(std::uint64_t key, const std::string& data,
+                              const boost::filesystem::path& path) const {
+    boost::system::error_code ec;
+    const auto temp_path =
+        dir / boost::filesystem::unique_path(fmt::format("{:016x}-%%%%-%%%%.tmp", key));
+    {
+        std::ofstream file(temp_path.string(), std::ios::binary);
+        if (!file.is_open()) {
+            spdlog::debug("Failed to write cache entry: {}", temp_path.string());
+            return false;
+        }
+        file.write(data.data(), static_cast<std::streamsize>(data.size()));
+    }
+    boost::filesystem::rename(temp_path, path, ec);
+    if (ec) {
+        boost::filesystem::remove(temp_path, ec);
+        return false;
+    }
+    return true;
+}
+
+bool header_cache::load_record(std::uint64_t key, output_record& record) const {
+    if (dir.empty()) {
+        return false;
+    }
+    std::ifstream file(record_path(key).string(), std::ios::binary);
+    if (!file.is_open()) {
+        return false;
+    }
+    const std::string data((std::istreambuf_iterator<char>(file)),
+                           std::istreambuf_iterator<char>());
+
+    cache_io::reader in{data};
+    if (in.string() != magic || in.u64() != key) {
+        return false;
+    }
+    record.output_hash = in.u64();
+    const auto file_count = in.u64();
+    for (std::uint64_t i = 0; in.ok && i < file_count; ++i) {
+        auto name = in.string();
+        record.files.emplace_back(std::move(name), in.u64());
+    }
+    const auto directory_count = in.u64();
+    for (std::uint64_t i = 0; in.ok && i < directory_count; ++i) {
+        auto name = in.string();
+        record.directories.emplace_back(std::move(name), static_cast<std::int64_t>(in.u64()));
+    }
+    if (!in.ok || !in.data.empty()) {
+        return false;
+    }
+    boost::system::error_code ec;
+    boost::filesystem::last_write_time(record_path(key), std::time(nullptr), ec);
+    return true;
+}
+
+void header_cache::store_record(std::uint64_t key, const output_record& record) const {
+    if (dir.empty()) {
+        return;
+    }
+    std::string data;
+    cache_io::put_string(data, magic);
+    cache_io::put_u64(data, key);
+    cache_io::put_u64(data, record.output_hash);
+    cache_io::put_u64(data, record.files.size());
+    for (const auto& [name, hash] : record.files) {
+        cache_io::put_string(data, name);
+        cache_io::put_u64(data, hash);
+    }
+    cache_io::put_u64(data, record.directories.size());
+    for (const auto& [name, time] : record.directories) {
+        cache_io::put_string(data, name);
+        cache_io::put_u64(data, static_cast<std::uint64_t>(time));
+    }
+    write_file(key, data, record_path(key));
+}
+
+void header_cache::prune() const {
+    struct cache_file {
+        boost::filesystem::path path;
+        std::uintmax_t size;
+        std::time_t last_use;
+    };
+    std::vector<cache_file> files;
+    std::uintmax_t total = 0;
+    boost::system::error_code ec;
+    for (boost::filesystem::directory_iterator it(dir, ec), end; !ec && it != end;
+         it.increment(ec)) {
+        const auto& path = it->path();
+        if (path.extension() != ".ceq" && path.extension() != ".ceqr") {
+            continue;
+        }
+        const auto size = boost::filesystem::file_size(path, ec);
+        const auto last_use = boost::filesystem::last_write_time(path, ec);
+        if (ec) {
+            ec.clear();
+            continue;
+        }
+        files.push_back({path, size, last_use});
+        total += size;
+    }
+    if (total <= max_disk_bytes) {
+        return;
+    }
+    std::sort(files.begin(), files.end(),
+              [](const auto& a, const auto& b) { return a.last_use < b.last_use; });
+    std::size_t removed = 0;
+    for (const auto& file : files) {
+        if (total <= max_disk_bytes) {
+            break;
+        }
+        if (boost::filesystem::remove(file.path, ec)) {
+            total -= file.size;
+            ++removed;
+        }
+    }
+    spdlog::debug("Header cache: pruned {} entries, {} bytes left", removed, total);
+}
+
+boost::filesystem::path default_cache_dir() {
+#if defined(_WIN32)
+    if (const char* local_app_data = std::getenv("LOCALAPPDATA"); local_app_data != nullptr) {
+        return boost::filesystem::path(local_app_data) / "cequip" / "cache";
+    }
+#else
+    if (const char* xdg_cache = std::getenv("XDG_CACHE_HOME"); xdg_cache && *xdg_cache) {
+        return boost::filesystem::path(xdg_cache) / "cequip";
+    }
+    if (const char* home = std::getenv("HOME"); home && *home) {
+        return boost::filesystem::path(home) / ".cache" / "cequip";
+    }
+#endif
+    return {};
+}
+
+std::uint64_t make_cache_config_key(const run_config& config,
+                                    const include_list_type& include_paths,
+                                    const std::vector<std::string>& predefined_macros,
+                                    std::uint64_t prelude_hash) {
+    auto key = hash_combine(hash_bytes(PROJECT_VERSION), BOOST_VERSION);
+    key = hash_combine(key, prelude_hash);
+    key = hash_combine(key, config.lang);
+    key = hash_combine(key, static_cast<std::uint64_t>(config.eol));
+    key = hash_combine(key, config.remove_comments);
+    for (const auto& pattern : config.kept_comment_patterns) {
+        key = hash_combine(key, hash_bytes(pattern));
+    }
+    key = hash_combine(key, config.minify);
+    key = hash_combine(key, config.minify_macros);
+    key = hash_combine(key, config.hoist_system_includes);
+    key = hash_combine(key, hash_bytes(config.system_include_umbrella));
+    key = hash_combine(key, config.expand_file_macros);
+    key = hash_combine(key, config.expand_line_macros);
+    key = hash_combine(key, config.expand_include_level_macros);
+    for (const auto& def : predefined_macros) {
+        key = hash_combine(key, hash_bytes(def));
+    }
+    for (const auto& root : include_paths) {
+        key = hash_combine(hash_combine(key, hash_bytes(root.dir.string())),
+                           hash_bytes(root.dir_raw));
+    }
+    return key;
+}
+
+}  // namespace cequip::internal
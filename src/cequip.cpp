@@ -0,0 +1,58 @@
+#include "cequip.hpp"
+
+#include "internal/cli.hpp"
+#include "internal/file_system.hpp"
+#include "internal/output.hpp"
+#include "internal/preprocess.hpp"
+
+#include <algorithm>
+
+namespace cequip {
+
+bundle preprocess(std::string_view main_path, std::string_view main_source,
+                  const virtual_file_system& files, const options& options) {
+    static constexpr const char* language_names[] = {"c99",   "cpp98", "cpp11",
+                                                     "cpp17", "cpp20", "cpp23"};
+    static constexpr const char* eol_names[] = {"as-is", "native", "lf", "crlf"};
+    internal::run_config config{};
+    config.lang = internal::parse_language(language_names[static_cast<int>(options.lang)]);
+    config.eol = internal::parse_eol(eol_names[static_cast<int>(options.eol)]);
+    config.definitions = options.definitions;
+    config.remove_comments = options.remove_comments;
+    config.kept_comment_patterns = options.keep_comments_matching;
+    config.minify = options.minify || options.minify_macros;
+    config.minify_macros = options.minify_macros;
+    config.tree_shake = options.tree_shake;
+    config.hoist_system_includes = options.hoist_system_includes;
+    config.system_include_umbrella = options.system_include_umbrella;
+    config.expand_file_macros = options.expand_file_macros;
+    config.expand_line_macros = options.expand_line_macros;
+    config.expand_include_level_macros = options.expand_include_level_macros;
+    config.no_pass_through = !options.pass_through;
+
+    internal::memory_file_system memory;
+    for (const auto& [path, contents] : files.files) {
+        memory.add(path, contents);
+    }
+    internal::shared_setup setup;
+    for (const auto& root : files.include_roots) {
+        setup.include_paths.push_back({internal::memory_file_system::normalize(root), root});
+    }
+    setup.predefined_macros = internal::make_predefined_macros(config);
+    setup.files = &memory;
+
+    bundle result;
+    internal::output_buffer output;
+    result.success = internal::preprocess(
+        config, internal::memory_file_system::normalize(main_path), setup, main_source, output,
+        &result.included_files, nullptr, &result.diagnostics);
+    if (result.success) {
+        result.output = output.view(0);
+    }
+    std::sort(result.included_files.begin(), result.included_files.end());
+    return result;
+}
+
+int run_command_line(int argc, char** argv) { return internal::run_command_line(argc, argv); }
+
+}  // namespace cequip
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <functional>
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Library interface of cequip. A bundle is preprocessed from sources held in memory, so nothing
+// is read from disk and nothing is logged; problems come back as diagnostics. Calls share no
+// state and may run concurrently from any number of threads.
+namespace cequip {
+
+enum class language { c99, cpp98, cpp11, cpp17, cpp20, cpp23 };
+
+enum class end_of_line { as_is, native, lf, crlf };
+
+// Sources by path. Relative paths, of files and include roots alike, are taken as relative to
+// the root of the file system, so "inc/a.hpp" and "/inc/a.hpp" name the same file.
+struct virtual_file_system {
+    std::map<std::string, std::string, std::less<>> files;
+    // Searched in order for includes not found next to the including file.
+    std::vector<std::string> include_roots;
+};
+
+// The preprocessing options of the command line tool, with the same defaults.
+struct options {
+    language lang = language::cpp23;
+    end_of_line eol = end_of_line::as_is;
+    std::vector<std::string> definitions;  // NAME or NAME=VALUE, like -d.
+    bool remove_comments = false;
+    // Comments kept by remove_comments and minify, as texts matched ignoring case. Empty keeps
+    // license and copyright notices.
+    std::vector<std::string> keep_comments_matching;
+    bool minify = false;
+    bool minify_macros = false;
+    bool tree_shake = false;
+    // System includes written once at the top of the output, as far as that keeps their meaning.
+    bool hoist_system_includes = false;
+    // Included in place of every standard library header if set, e.g. "bits/stdc++.h".
+    std::string system_include_umbrella;
+    bool expand_file_macros = false;
+    bool expand_line_macros = false;
+    bool expand_include_level_macros = false;
+    bool pass_through = true;
+};
+
+struct diagnostic {
+    enum class severity { warning, error };
+
+    severity level = severity::error;
+    std::string message;
+    // Where it happened, if known; the path as resolved in the virtual file system.
+    std::string file;
+    unsigned int line = 0;
+    unsigned int column = 0;
+};
+
+struct bundle {
+    bool success = false;
+    std::string output;
+    std::vector<diagnostic> diagnostics;
+    std::vector<std::string> included_files;  // Resolved paths, sorted.
+};
+
+// Bundles main_source, which is known as main_path, with the files it includes. main_path does
+// not need to be in files.
+bundle preprocess(std::string_view main_path, std::string_view main_source,
+                  const virtual_file_system& files, const options& options = {});
+
+// Runs the command line tool and returns its exit code.
+int run_command_line(int argc, char** argv);
+
+}  // namespace cequip
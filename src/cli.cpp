@@ -0,0 +1,819 @@
+#include "internal/cli.hpp"
+
+#include "cequip.hpp"
+#include "internal/batch.hpp"
+#include "internal/cache.hpp"
+#include "internal/file_system.hpp"
+#include "internal/preprocess.hpp"
+#include "internal/report.hpp"
+#include "internal/server.hpp"
+
+#include <spdlog/spdlog.h>
+
+#include <CLI/CLI.hpp>
+#include <boost/filesystem.hpp>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <optional>
+#include <thread>
+
+#if defined(__linux__)
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+namespace cequip::internal {
+
+bool parse_cli(int argc, char** argv, run_config& config, int& exit_code,
+               std::string* usage_error) {
+    config = {};
+    CLI::App app;
+
+    app.add_flag("-v,--version", config.version_flag, "Show version information");
+    app.add_option("files", config.input_files_raw,
+                   "Input files to process (wildcards in the file name are expanded)");
+    app.add_option("--manifest", config.manifest_file_raw,
+                   "File listing one input per line, optionally followed by its output path");
+    app.add_option("--matrix", config.matrix_file_raw,
+                   "File listing one configuration per line: an output path followed by the "
+                   "options it adds; the input is preprocessed once per configuration");
+    app.add_option("-o,--output", config.output_file_raw, "Output file")->default_val("stdout");
+    app.add_option("--output-dir", config.output_dir_raw,
+                   "Output directory for inputs without an explicit output path");
+    app.add_option("-j,--jobs", config.jobs,
+                   "Worker threads used for multiple inputs (0 uses all hardware threads)")
+        ->default_val(0);
+    app.add_option("-i,--include", config.include_paths_raw, "Include paths for preprocessing");
+    app.add_option("-d,--define", config.definitions, "Preprocessor definitions");
+    app.add_option("--prelude", config.prelude_file_raw,
+                   "Header whose macros and include guards every input starts with; its text "
+                   "is not emitted");
+    app.add_option("--prelude-snapshot", config.prelude_snapshot_raw,
+                   "Keep the state left by --prelude in this file and reuse it while the "
+                   "prelude, its headers and the options it depends on are unchanged");
+    app.add_flag("--expand-file-macros", config.expand_file_macros, "Expand __FILE__ macros");
+    app.add_flag("--expand-line-macros", config.expand_line_macros, "Expand __LINE__ macros");
+    app.add_flag("--expand-include-level-macros", config.expand_include_level_macros,
+                 "Expand __INCLUDE_LEVEL__ macros");
+    app.add_flag("--remove-comments", config.remove_comments, "Remove comments from output");
+    app.add_option("--keep-comments-matching", config.kept_comment_patterns,
+                   "With --remove-comments or --minify, keep comments containing any of these "
+                   "texts, ignoring case (default: copyright, license, (c), all rights "
+                   "reserved, ©, ®)");
+    app.add_flag("--minify", config.minify,
+                 "Drop comments and whitespace wherever tokens stay apart without it");
+    app.add_flag("--minify-macros", config.minify_macros,
+                 "With --minify, also drop spaces in #define bodies (may change the text of "
+                 "stringized macro expansions)");
+    app.add_flag("--no-pass-through", config.no_pass_through,
+                 "Lex every line with Wave, including those that would be copied verbatim");
+    app.add_flag("--prefetch", config.prefetch,
+                 "Read included files ahead on worker threads instead of when Wave reaches them");
+    app.add_flag("--tree-shake", config.tree_shake,
+                 "Drop definitions of included files that nothing reachable from the main file "
+                 "uses");
+    app.add_flag("--hoist-system-includes", config.hoist_system_includes,
+                 "Write every system include once at the top of the output, up to the first "
+                 "directive that may configure the headers included after it");
+    app.add_option("--system-include-umbrella", config.system_include_umbrella,
+                   "Include this header, e.g. bits/stdc++.h, in place of every standard library "
+                   "header");
+    app.add_option("--end-of-line", config.eol_str, "End-of-line sequence")
+        ->check(CLI::IsMember({"as-is", "native", "lf", "crlf"}))
+        ->default_val("as-is");
+    app.add_flag("-q,--quiet", config.quiet_flag, "Suppress non-error output");
+    app.add_flag("-w,--watch", config.watch,
+                 "Keep running and rebuild whenever the input or an included file changes");
+    app.add_option("--cache-dir", config.cache_dir_raw,
+                   "Directory of the preprocessed header cache (default: user cache directory)");
+    app.add_option("--cache-size", config.cache_size_mb,
+                   "Size in MiB the cache directory is pruned to after a run stores entries")
+        ->default_val(512);
+    app.add_flag("--no-cache", config.no_cache, "Disable the preprocessed header cache");
+    app.add_option("--trace", config.trace_file_raw,
+                   "Write a Chrome trace-event JSON of the run to this file");
+    app.add_option("--depfile", config.depfile_raw,
+                   "Write a Make-style depfile listing the files the output was built from");
+    app.add_flag("--md", config.depfile_per_output,
+                 "Write a depfile next to each output file, named after it with .d appended");
+    app.add_option("--size-report", config.size_report_file_raw,
+                   "Write output bytes per header and per re-emitted macro to this file "
+                   "(JSON if it ends in .json, implies --no-cache)");
+    app.add_flag("--profile-macros", config.profile_macros,
+                 "Time and count the macro expansions of #if expressions and computed includes, "
+                 "and print the slowest macros (implies --no-cache)");
+    app.add_option("--lang", config.lang_str, "Language standard")
+        ->check(CLI::IsMember({"c99", "cpp98", "cpp11", "cpp17", "cpp20", "cpp23"}))
+        ->default_val("cpp23");
+
+    auto* pack = app.add_subcommand(
+        "pack", "Pack all files below the include paths into one archive, usable as an include "
+                "path in their place");
+    pack->add_option("-i,--include", config.include_paths_raw, "Include paths to pack")
+        ->required();
+    pack->add_option("-o,--output", config.pack_file_raw, "Archive file")->required();
+
+    auto* serve = app.add_subcommand(
+        "serve", "Keep running and preprocess requests read from stdin or a Unix socket, with "
+                 "files, include paths and headers kept warm between them");
+    serve->add_option("--socket", config.socket_path_raw,
+                      "Listen on this Unix domain socket instead of reading stdin");
+    serve->add_option("-j,--jobs", config.jobs,
+                      "Requests handled at once (0 uses all hardware threads)")
+        ->default_val(0);
+
+    try {
+        app.parse(argc, argv);
+    } catch (const CLI::ParseError& e) {
+        if (usage_error != nullptr) {
+            *usage_error = e.what();
+            exit_code = 1;
+        } else {
+            exit_code = app.exit(e);
+        }
+        return false;
+    }
+    config.pack = pack->parsed();
+    config.serve = serve->parsed();
+    return true;
+}
+
+void configure_logging(const run_config& config) {
+    spdlog::default_logger()->set_pattern("[%^%l%$] %v");
+    if (config.quiet_flag) {
+        spdlog::set_level(spdlog::level::err);
+    }
+}
+
+namespace {
+
+bool matches_wildcard(std::string_view pattern, std::string_view name) {
+    std::size_t p = 0;
+    std::size_t n = 0;
+    std::size_t star = std::string_view::npos;
+    std::size_t resume = 0;
+    while (n < name.size()) {
+        if (p < pattern.size() && (pattern[p] == '?' || pattern[p] == name[n])) {
+            ++p;
+            ++n;
+        } else if (p < pattern.size() && pattern[p] == '*') {
+            star = p++;
+            resume = n;
+        } else if (star != std::string_view::npos) {
+            p = star + 1;
+            n = ++resume;
+        } else {
+            return false;
+        }
+    }
+    while (p < pattern.size() && pattern[p] == '*') {
+        ++p;
+    }
+    return p == pattern.size();
+}
+
+bool expand_input_pattern(const std::string& pattern, std::vector<std::string>& input_files) {
+    if (pattern.find_first_of("*?") == std::string::npos) {
+        input_files.push_back(pattern);
+        return true;
+    }
+    const boost::filesystem::path pattern_path(pattern);
+    const auto dir = pattern_path.parent_path();
+    if (dir.string().find_first_of("*?") != std::string::npos) {
+        spdlog::error("Wildcards are only supported in the file name: {}", pattern);
+        return false;
+    }
+
+    const auto name_pattern = pattern_path.filename().string();
+    boost::system::error_code ec;
+    std::vector<std::string> matched;
+    for (const auto& entry : boost::filesystem::directory_iterator(
+             dir.empty() ? boost::filesystem::path(".") : dir, ec)) {
+        const auto name = entry.path().filename().string();
+        if (matches_wildcard(name_pattern, name) &&
+            boost::filesystem::is_regular_file(entry.status())) {
+            matched.push_back((dir / name).string());
+        }
+    }
+    if (ec) {
+        spdlog::error("Failed to list directory for pattern '{}': {}", pattern, ec.message());
+        return false;
+    }
+    if (matched.empty()) {
+        spdlog::error("No input files match pattern: {}", pattern);
+        return false;
+    }
+    std::ranges::sort(matched);
+    input_files.insert(input_files.end(), matched.begin(), matched.end());
+    return true;
+}
+
+bool load_manifest(const std::string& manifest_file_raw, std::vector<batch_job>& jobs) {
+    std::ifstream manifest(manifest_file_raw);
+    if (!manifest.is_open()) {
+        spdlog::error("Failed to open manifest file: {}", manifest_file_raw);
+        return false;
+    }
+    std::string line;
+    for (std::size_t line_no = 1; std::getline(manifest, line); ++line_no) {
+        std::istringstream fields(line);
+        batch_job job;
+        if (!(fields >> std::quoted(job.input_file_raw)) || job.input_file_raw.starts_with('#')) {
+            continue;
+        }
+        fields >> std::quoted(job.output_file_raw);
+        std::string extra;
+        if (fields >> extra) {
+            spdlog::error("Unexpected field '{}' at {}:{}", extra, manifest_file_raw, line_no);
+            return false;
+        }
+        jobs.push_back(std::move(job));
+    }
+    return true;
+}
+
+bool collect_jobs(const run_config& config, std::vector<batch_job>& jobs) {
+    std::vector<std::string> input_files;
+    for (const auto& pattern : config.input_files_raw) {
+        if (!expand_input_pattern(pattern, input_files)) {
+            return false;
+        }
+    }
+    for (auto& input_file : input_files) {
+        jobs.push_back({std::move(input_file), {}});
+    }
+    if (!config.manifest_file_raw.empty() && !load_manifest(config.manifest_file_raw, jobs)) {
+        return false;
+    }
+    if (jobs.empty()) {
+        spdlog::error("No input files provided. Use --help for usage information.");
+        return false;
+    }
+
+    boost::system::error_code ec;
+    if (!config.output_dir_raw.empty()) {
+        boost::filesystem::create_directories(config.output_dir_raw, ec);
+        if (ec) {
+            spdlog::error("Failed to create output directory '{}': {}", config.output_dir_raw,
+                          ec.message());
+            return false;
+        }
+    }
+    boost::unordered_flat_set<std::string> output_files;
+    for (auto& job : jobs) {
+        if (job.output_file_raw.empty()) {
+            if (!config.output_dir_raw.empty()) {
+                job.output_file_raw =
+                    (boost::filesystem::path(config.output_dir_raw) /
+                     boost::filesystem::path(job.input_file_raw).filename())
+                        .string();
+            } else if (jobs.size() == 1) {
+                job.output_file_raw = config.output_file_raw;
+            } else {
+                spdlog::error("No output path for '{}' (use --output-dir or --manifest)",
+                              job.input_file_raw);
+                return false;
+            }
+        }
+        if (job.output_file_raw == "stdout" || job.output_file_raw == "stderr") {
+            continue;
+        }
+        const auto output_path = boost::filesystem::weakly_canonical(job.output_file_raw, ec);
+        if (!output_files.insert(ec ? job.output_file_raw : output_path.string()).second) {
+            spdlog::error("Multiple inputs would be written to the same output: {}",
+                          job.output_file_raw);
+            return false;
+        }
+    }
+    return true;
+}
+
+}  // namespace
+
+boost::wave::language_support parse_language(const std::string& lang_str) {
+    if (lang_str == "c99") {
+        return boost::wave::language_support::support_c99;
+    }
+    if (lang_str == "cpp98") {
+        return boost::wave::language_support::support_cpp;
+    }
+    if (lang_str == "cpp11") {
+        return boost::wave::language_support::support_cpp11;
+    }
+    if (lang_str == "cpp17") {
+        return boost::wave::language_support::support_cpp17;
+    }
+    if (lang_str == "cpp20") {
+        return boost::wave::language_support::support_cpp20;
+    }
+    if (lang_str == "cpp23") {
+        return boost::wave::language_support::support_cpp2a;
+    }
+    std::unreachable();
+}
+
+eol_type parse_eol(const std::string& eol_value) {
+    if (eol_value == "as-is") {
+        return eol_type::as_is;
+    }
+    if (eol_value == "native") {
+        return eol_type::native;
+    }
+    if (eol_value == "lf") {
+        return eol_type::lf;
+    }
+    if (eol_value == "crlf") {
+        return eol_type::crlf;
+    }
+    std::unreachable();
+}
+
+std::vector<std::string> make_predefined_macros(const run_config& config) {
+    std::vector<std::string> macros{"__CEQUIP__", "true=1", "false=0"};
+    macros.insert(macros.end(), config.definitions.begin(), config.definitions.end());
+    return macros;
+}
+
+namespace {
+
+// One configuration of a --matrix run and what its run needs of its own.
+struct matrix_entry {
+    run_config config;
+    batch_job job;
+    shared_setup setup;
+    std::vector<cache_event> prelude;
+    std::optional<header_cache> cache;
+};
+
+// Reads a matrix file: one configuration per line, its output path followed by the options it
+// adds to the command line. Empty lines and lines starting with # are skipped.
+bool load_matrix(int argc, char** argv, const std::string& matrix_file_raw,
+                 std::deque<matrix_entry>& entries) {
+    std::ifstream matrix(matrix_file_raw);
+    if (!matrix.is_open()) {
+        spdlog::error("Failed to open matrix file: {}", matrix_file_raw);
+        return false;
+    }
+    std::string line;
+    for (std::size_t line_no = 1; std::getline(matrix, line); ++line_no) {
+        std::istringstream fields(line);
+        std::string output;
+        if (!(fields >> std::quoted(output)) || output.starts_with('#')) {
+            continue;
+        }
+        std::vector<std::string> arguments(argv, argv + argc);
+        for (std::string option; fields >> std::quoted(option);) {
+            arguments.push_back(std::move(option));
+        }
+        arguments.push_back("-o");
+        arguments.push_back(output);
+        std::vector<char*> args;
+        for (auto& arg : arguments) {
+            args.push_back(arg.data());
+        }
+
+        auto& entry = entries.emplace_back();
+        auto& config = entry.config;
+        std::string usage_error;
+        if (int exit_code; !parse_cli(static_cast<int>(args.size()), args.data(), config,
+                                      exit_code, &usage_error)) {
+            spdlog::error("Invalid options at {}:{}: {}", matrix_file_raw, line_no, usage_error);
+            return false;
+        }
+        if (config.input_files_raw.size() != 1 || !config.manifest_file_raw.empty() ||
+            !config.output_dir_raw.empty() || config.watch || !config.trace_file_raw.empty() ||
+            !config.size_report_file_raw.empty() || config.profile_macros ||
+            !config.depfile_raw.empty() || !config.prelude_snapshot_raw.empty()) {
+            spdlog::error("--matrix takes one input and cannot be combined with --manifest, "
+                          "--output-dir, --watch, --trace, --size-report, --profile-macros, "
+                          "--depfile or --prelude-snapshot ({}:{})",
+                          matrix_file_raw, line_no);
+            return false;
+        }
+        config.lang = parse_language(config.lang_str);
+        config.eol = parse_eol(config.eol_str);
+        config.minify = config.minify || config.minify_macros;
+        std::vector<batch_job> jobs;
+        if (!collect_jobs(config, jobs)) {
+            return false;
+        }
+        if (jobs.size() != 1) {
+            spdlog::error("--matrix takes one input, not {}", jobs.size());
+            return false;
+        }
+        entry.job = std::move(jobs.front());
+    }
+    if (entries.empty()) {
+        spdlog::error("No configurations in matrix file: {}", matrix_file_raw);
+        return false;
+    }
+    return true;
+}
+
+// Preprocesses one input once per configuration of a matrix file, all at the same time. The
+// runs share the files they read, the include directory listings and the read-ahead, so every
+// file is read and hashed once however many configurations include it.
+bool run_matrix(int argc, char** argv, const run_config& config) {
+    if (config.output_file_raw != "stdout") {
+        spdlog::error("--matrix takes the output paths from the matrix file, not -o");
+        return false;
+    }
+    std::deque<matrix_entry> entries;
+    if (!load_matrix(argc, argv, config.matrix_file_raw, entries)) {
+        return false;
+    }
+    boost::unordered_flat_set<std::string> output_files;
+    for (const auto& entry : entries) {
+        const auto& output = entry.job.output_file_raw;
+        boost::system::error_code ec;
+        const auto output_path = boost::filesystem::weakly_canonical(output, ec);
+        if (!is_console(output) &&
+            !output_files.insert(ec ? output : output_path.string()).second) {
+            spdlog::error("Multiple configurations would be written to the same output: {}",
+                          output);
+            return false;
+        }
+    }
+
+    include_index includes;
+    file_cache loaded_files;
+    for (auto& entry : entries) {
+        auto& setup = entry.setup;
+        if (!resolve_include_paths(entry.config.include_paths_raw, setup.include_paths)) {
+            return false;
+        }
+        setup.predefined_macros = make_predefined_macros(entry.config);
+        setup.includes = &includes;
+        setup.loaded_files = &loaded_files;
+        std::uint64_t prelude_hash = 0;
+        if (!setup_prelude(entry.config, setup, entry.prelude, prelude_hash)) {
+            return false;
+        }
+        setup_header_cache(entry.config, setup, prelude_hash, entry.cache);
+    }
+    // Last, so that no read ahead is still running when the rest goes.
+    std::optional<prefetch_pool> prefetch;
+    if (config.prefetch) {
+        prefetch.emplace(std::clamp<std::size_t>(std::thread::hardware_concurrency(), 2, 8));
+        for (auto& entry : entries) {
+            entry.setup.prefetch = &*prefetch;
+        }
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    const std::size_t worker_count =
+        config.jobs != 0 ? config.jobs : std::max(1u, std::thread::hardware_concurrency());
+    work_stealing_pool pool(std::min(worker_count, entries.size()));
+    std::atomic<std::size_t> failed_count = 0;
+    pool.run(entries.size(), [&](std::size_t index) {
+        const auto& entry = entries[index];
+        std::uintmax_t input_bytes = 0;
+        if (!process_job(entry.config, entry.job, entry.setup, input_bytes, false)) {
+            ++failed_count;
+        }
+    });
+
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    spdlog::info("Processed {} configurations ({} failed) with {} workers in {:.3f} s",
+                 entries.size(), failed_count.load(), pool.size(), elapsed.count());
+    spdlog::info("Files: {} read, {} reads shared between configurations",
+                 loaded_files.misses.load(), loaded_files.hits.load());
+    return failed_count == 0;
+}
+
+// Reports which of a set of files may have changed. Watches the parent directories rather than
+// the files themselves so editors that save by renaming a temporary file are still noticed.
+class file_watcher : boost::noncopyable {
+    boost::unordered_flat_set<std::string> files;
+#if defined(__linux__)
+    int fd = -1;
+    boost::unordered_flat_map<int, std::string> watched_dirs;
+#else
+    boost::unordered_flat_map<std::string, std::pair<std::time_t, std::uintmax_t>> stamps;
+
+    static std::pair<std::time_t, std::uintmax_t> stamp(const std::string& file) {
+        boost::system::error_code ec;
+        const auto time = boost::filesystem::last_write_time(file, ec);
+        const auto size = boost::filesystem::file_size(file, ec);
+        return {ec ? 0 : time, ec ? 0 : size};
+    }
+#endif
+
+   public:
+#if defined(__linux__)
+    file_watcher() : fd(inotify_init1(IN_CLOEXEC)) {}
+    ~file_watcher() {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+    bool valid() const { return fd >= 0; }
+#else
+    bool valid() const { return true; }
+#endif
+
+    void watch(const std::vector<std::string>& watched_files) {
+        files = {watched_files.begin(), watched_files.end()};
+#if defined(__linux__)
+        boost::unordered_flat_set<std::string> dirs;
+        for (const auto& file : files) {
+            dirs.insert(boost::filesystem::path(file).parent_path().string());
+        }
+        for (auto it = watched_dirs.begin(); it != watched_dirs.end();) {
+            if (dirs.erase(it->second) == 0) {
+                inotify_rm_watch(fd, it->first);
+                it = watched_dirs.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        for (const auto& dir : dirs) {
+            const int wd = inotify_add_watch(
+                fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_DELETE);
+            if (wd < 0) {
+                spdlog::warn("Failed to watch directory: {}", dir);
+                continue;
+            }
+            watched_dirs[wd] = dir;
+        }
+#else
+        stamps.clear();
+        for (const auto& file : files) {
+            stamps[file] = stamp(file);
+        }
+#endif
+    }
+
+    // Blocks until at least one watched file was touched and returns the touched files.
+    std::vector<std::string> wait() {
+        boost::unordered_flat_set<std::string> touched;
+#if defined(__linux__)
+        alignas(inotify_event) char buffer[16 * 1024];
+        int timeout = -1;
+        pollfd pfd{fd, POLLIN, 0};
+        // After the first event keep draining briefly, as one save often produces several.
+        while (poll(&pfd, 1, timeout) > 0) {
+            const auto length = read(fd, buffer, sizeof(buffer));
+            if (length <= 0) {
+                break;
+            }
+            for (ssize_t offset = 0; offset < length;) {
+                const auto* event = reinterpret_cast<const inotify_event*>(buffer + offset);
+                offset += static_cast<ssize_t>(sizeof(inotify_event) + event->len);
+                auto dir = watched_dirs.find(event->wd);
+                if (event->len == 0 || dir == watched_dirs.end()) {
+                    continue;
+                }
+                auto file = (boost::filesystem::path(dir->second) / event->name).string();
+                if (files.contains(file)) {
+                    touched.insert(std::move(file));
+                }
+            }
+            timeout = touched.empty() ? -1 : 5;
+        }
+#else
+        while (touched.empty()) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            for (auto& [file, last] : stamps) {
+                if (auto current = stamp(file); current != last) {
+                    last = current;
+                    touched.insert(file);
+                }
+            }
+        }
+#endif
+        return {touched.begin(), touched.end()};
+    }
+};
+
+bool run_watch(const run_config& config, const batch_job& job, shared_setup setup) {
+    boost::filesystem::path path;
+    if (!resolve_input_path(job.input_file_raw, path)) {
+        return false;
+    }
+    file_watcher watcher;
+    if (!watcher.valid()) {
+        spdlog::error("Failed to initialize file watching");
+        return false;
+    }
+
+    // Included files are replayed from the in-memory header cache unless they changed, so a
+    // rebuild only lexes the input and whatever was edited.
+    std::optional<header_cache> memory_cache;
+    if (setup.cache == nullptr && setup.sizes == nullptr && setup.profile == nullptr) {
+        memory_cache.emplace(boost::filesystem::path(), 0);
+        setup.cache = &*memory_cache;
+    }
+    boost::unordered_flat_map<std::string, std::uint64_t> content_hashes;
+    setup.known_content_hashes = &content_hashes;
+    const auto path_str = path.string();
+    std::vector<std::string> dependencies;
+
+    while (true) {
+        const auto start = std::chrono::steady_clock::now();
+        if (setup.includes != nullptr) {
+            setup.includes->clear();
+        }
+        // Archives stay mapped as they were opened, so a repacked one is opened again.
+        if (std::any_of(setup.include_paths.begin(), setup.include_paths.end(),
+                        [](const auto& root) { return root.archive != nullptr; })) {
+            include_list_type include_paths;
+            if (resolve_include_paths(config.include_paths_raw, include_paths)) {
+                setup.include_paths = std::move(include_paths);
+            }
+        }
+        file_buffer contents;
+        output_sink sink;
+        output_buffer result(sink);
+        std::vector<std::string> included_files;
+        if (load_file_contents(path, contents) && sink.open(job.output_file_raw) &&
+            preprocess(config, path, setup, contents.view(), result, &included_files) &&
+            write_output(job.output_file_raw, sink, result)) {
+            dependencies = std::move(included_files);
+            if (const auto depfile = depfile_path(config, job); !depfile.empty()) {
+                auto files = dependencies;
+                files.push_back(path_str);
+                write_depfile(depfile, job.output_file_raw, std::move(files));
+            }
+            const std::chrono::duration<double, std::milli> elapsed =
+                std::chrono::steady_clock::now() - start;
+            spdlog::info("Rebuilt {} ({} dependencies) in {:.2f} ms", path_str,
+                         dependencies.size(), elapsed.count());
+            if (setup.sizes != nullptr) {
+                setup.sizes->write(config.size_report_file_raw);
+            }
+            if (setup.profile != nullptr) {
+                setup.profile->write("stderr", macro_profile_top);
+            }
+        }
+        if (setup.trace != nullptr) {
+            setup.trace->write(config.trace_file_raw);
+        }
+        if (setup.sizes != nullptr) {
+            setup.sizes->clear();
+        }
+        if (setup.profile != nullptr) {
+            setup.profile->clear();
+        }
+        dependencies.push_back(path_str);
+        for (const auto& file : dependencies) {
+            std::uint64_t hash;
+            if (!content_hashes.contains(file) && hash_file(file, hash)) {
+                content_hashes.emplace(file, hash);
+            }
+        }
+        watcher.watch(dependencies);
+        spdlog::info("Watching {} files for changes", dependencies.size());
+
+        // Touching a file without changing its bytes does not trigger a rebuild.
+        bool changed = false;
+        while (!changed) {
+            for (const auto& file : watcher.wait()) {
+                std::uint64_t hash = 0;
+                const bool readable = hash_file(file, hash);
+                auto it = content_hashes.find(file);
+                if (!readable || it == content_hashes.end() || it->second != hash) {
+                    changed = true;
+                    content_hashes.erase(file);
+                    if (readable) {
+                        content_hashes.emplace(file, hash);
+                    }
+                }
+            }
+        }
+    }
+}
+
+}  // namespace
+
+int run_command_line(int argc, char** argv) {
+    run_config config;
+    if (int exit_code; !parse_cli(argc, argv, config, exit_code)) {
+        return exit_code;
+    }
+    configure_logging(config);
+
+    if (config.version_flag) {
+        std::cout << PROJECT_VERSION << std::endl;
+        return 0;
+    }
+
+    if (config.pack) {
+        return write_include_archive(config.include_paths_raw, config.pack_file_raw) ? 0 : 1;
+    }
+    if (config.serve) {
+        return run_serve(config) ? 0 : 1;
+    }
+
+    config.lang = parse_language(config.lang_str);
+    config.eol = parse_eol(config.eol_str);
+    config.minify = config.minify || config.minify_macros;
+
+    if (!config.matrix_file_raw.empty()) {
+        return run_matrix(argc, argv, config) ? 0 : 1;
+    }
+
+    std::vector<batch_job> jobs;
+    if (!collect_jobs(config, jobs)) {
+        return 1;
+    }
+
+    shared_setup setup;
+    if (!resolve_include_paths(config.include_paths_raw, setup.include_paths)) {
+        return 1;
+    }
+    setup.predefined_macros = make_predefined_macros(config);
+    include_index includes;
+    setup.includes = &includes;
+    std::optional<keyword_matcher> kept_comments;
+    if (!config.kept_comment_patterns.empty()) {
+        setup.kept_comments = &kept_comments.emplace(config.kept_comment_patterns);
+    }
+    std::vector<cache_event> prelude;
+    std::uint64_t prelude_hash = 0;
+    if (!setup_prelude(config, setup, prelude, prelude_hash)) {
+        return 1;
+    }
+    std::optional<trace_recorder> trace;
+    if (!config.trace_file_raw.empty()) {
+        trace.emplace();
+        setup.trace = &*trace;
+    }
+    // Cached headers are replayed as a whole, which would hide the files nested in them.
+    std::optional<size_report> sizes;
+    if (!config.size_report_file_raw.empty()) {
+        sizes.emplace();
+        setup.sizes = &*sizes;
+        config.no_cache = true;
+    }
+    // Likewise the directives in them, whose macros are the ones profiled.
+    std::optional<macro_profile> profile;
+    if (config.profile_macros) {
+        profile.emplace();
+        setup.profile = &*profile;
+        config.no_cache = true;
+    }
+
+    std::optional<header_cache> cache;
+    setup_header_cache(config, setup, prelude_hash, cache);
+
+    if (!config.depfile_raw.empty() && jobs.size() != 1) {
+        spdlog::error("--depfile requires exactly one input file; use --md for several");
+        return 1;
+    }
+
+    include_wait waits;
+    setup.waits = &waits;
+    // Last, so that no read ahead is still running when the rest of the setup goes.
+    std::optional<prefetch_pool> prefetch;
+    if (config.prefetch) {
+        prefetch.emplace(std::clamp<std::size_t>(std::thread::hardware_concurrency(), 2, 8));
+        setup.prefetch = &*prefetch;
+    }
+
+    if (config.watch) {
+        if (jobs.size() != 1) {
+            spdlog::error("--watch requires exactly one input file");
+            return 1;
+        }
+        return run_watch(config, jobs.front(), setup) ? 0 : 1;
+    }
+    bool success;
+    if (jobs.size() == 1) {
+        std::uintmax_t input_bytes = 0;
+        success = process_job(config, jobs.front(), setup, input_bytes);
+    } else {
+        success = run_batch(config, jobs, setup);
+    }
+    // A trace is most useful when something went wrong, so it is written either way.
+    if (trace && !trace->write(config.trace_file_raw)) {
+        success = false;
+    }
+    if (sizes && success && !sizes->write(config.size_report_file_raw)) {
+        success = false;
+    }
+    if (profile && success && !profile->write("stderr", macro_profile_top)) {
+        success = false;
+    }
+    if (!success) {
+        return 1;
+    }
+
+    if (cache) {
+        spdlog::info("Header cache: {} hits, {} misses, {} entries stored", cache->hits.load(),
+                     cache->misses.load(), cache->stores.load());
+    }
+    spdlog::info("Include index: {} directories listed, {} filesystem probes saved",
+                 includes.directories_listed.load(), includes.probes_saved.load());
+    spdlog::info("Waited for includes: {:.3f} ms resolving, {:.3f} ms loading{}",
+                 static_cast<double>(waits.resolve_ns.load()) / 1e6,
+                 static_cast<double>(waits.load_ns.load()) / 1e6,
+                 prefetch ? " (prefetched)" : "");
+    spdlog::info("Preprocessing completed successfully.");
+    return 0;
+}
+
+}  // namespace cequip::internal
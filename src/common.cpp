@@ -0,0 +1,16 @@
+#include "internal/common.hpp"
+
+#include <cstdio>
+
+namespace cequip::internal {
+
+bool hash_file(const std::string& file, std::uint64_t& hash) {
+    file_buffer contents;
+    if (!contents.open(file.c_str())) {
+        return false;
+    }
+    hash = hash_bytes(contents.view());
+    return true;
+}
+
+}  // namespace cequip::internal
@@ -0,0 +1,225 @@
+#include "internal/file_system.hpp"
+
+#include "internal/cache.hpp"
+#include "internal/output.hpp"
+
+#include <spdlog/spdlog.h>
+
+#include <boost/filesystem.hpp>
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+
+namespace cequip::internal {
+
+std::int64_t directory_time(const std::string& dir) {
+    std::error_code ec;
+    const auto time = std::filesystem::last_write_time(dir, ec);
+    return ec ? 0 : time.time_since_epoch().count();
+}
+
+bool include_archive::open(const boost::filesystem::path& archive_file) {
+    file = archive_file;
+    opened_stamp = stamp();
+    if (!buffer.open(file.string().c_str())) {
+        spdlog::error("Failed to read include archive: {}", file.string());
+        return false;
+    }
+    const auto bytes = buffer.view();
+    cache_io::reader in{bytes};
+    if (in.string() != magic) {
+        spdlog::error("Not an include archive: {}", file.string());
+        return false;
+    }
+    if (const auto archive_version = in.u64(); archive_version != version) {
+        spdlog::error("Unsupported include archive version {} (expected {}): {}",
+                      archive_version, version, file.string());
+        return false;
+    }
+    cache_io::reader checksum{bytes.substr(bytes.size() - 8)};
+    if (checksum.u64() != hash_bytes(bytes.substr(0, bytes.size() - 8))) {
+        spdlog::error("Include archive is damaged (checksum mismatch): {}", file.string());
+        return false;
+    }
+
+    const auto contents_size = in.u64();
+    if (!in.ok || contents_size > in.data.size()) {
+        spdlog::error("Include archive is damaged: {}", file.string());
+        return false;
+    }
+    const auto contents = in.data.substr(0, contents_size);
+    in.data.remove_prefix(contents_size);
+    const auto root_count = in.u64();
+    for (std::uint64_t i = 0; in.ok && i < root_count; ++i) {
+        root_names.push_back(in.string());
+        auto& root = members.emplace_back();
+        const auto file_count = in.u64();
+        for (std::uint64_t j = 0; in.ok && j < file_count; ++j) {
+            auto name = in.string();
+            const auto offset = in.u64();
+            const auto size = in.u64();
+            const auto content_hash = in.u64();
+            if (offset > contents.size() || size > contents.size() - offset) {
+                in.ok = false;
+                break;
+            }
+            root.emplace(std::move(name), member{contents.substr(offset, size), content_hash});
+        }
+    }
+    if (!in.ok || in.data.size() != 8) {
+        spdlog::error("Include archive is damaged: {}", file.string());
+        return false;
+    }
+    return true;
+}
+
+const include_root* find_archive_root(const std::deque<include_root>& include_paths,
+                                      const boost::filesystem::path& path,
+                                      boost::filesystem::path& relative) {
+    for (const auto& root : include_paths) {
+        if (root.archive != nullptr) {
+            relative = path.lexically_relative(root.dir);
+            if (!relative.empty() && *relative.begin() != "..") {
+                return &root;
+            }
+        }
+    }
+    return nullptr;
+}
+
+const include_archive::member* find_archived(const std::deque<include_root>& include_paths,
+                                             const boost::filesystem::path& path) {
+    boost::filesystem::path relative;
+    const auto* root = find_archive_root(include_paths, path, relative);
+    return root != nullptr ? root->archive->find(root->archive_root, relative) : nullptr;
+}
+
+bool resolve_input_path(const std::string& input_file_raw, boost::filesystem::path& path) {
+    if (input_file_raw.empty()) {
+        spdlog::error("No input files provided. Use --help for usage information.");
+        return false;
+    }
+
+    boost::system::error_code ec;
+    path = boost::filesystem::canonical(input_file_raw, ec);
+    if (ec) {
+        spdlog::error("Failed to resolve path '{}': {}", input_file_raw, ec.message());
+        return false;
+    }
+    const auto file_size = boost::filesystem::file_size(path, ec);
+    if (ec) {
+        spdlog::error("Failed to get file size for '{}': {}", path.string(), ec.message());
+        return false;
+    }
+    if (file_size == 0) {
+        spdlog::warn("File is empty: {}", path.string());
+    }
+    return true;
+}
+
+bool load_file_contents(const boost::filesystem::path& path, file_buffer& contents) {
+    if (!contents.open(path.string().c_str())) {
+        spdlog::error("Failed to open file: {}", path.string());
+        return false;
+    }
+    return true;
+}
+
+bool resolve_include_paths(const std::vector<std::string>& include_paths_raw,
+                           include_list_type& include_paths) {
+    boost::system::error_code ec;
+    for (const auto& inc_path_raw : include_paths_raw) {
+        const auto inc_path = boost::filesystem::canonical(inc_path_raw, ec);
+        if (ec) {
+            spdlog::error("Failed to resolve include path '{}': {}", inc_path_raw, ec.message());
+            return false;
+        }
+        // A file is an archive written by `cequip pack`, standing in for the roots it holds.
+        if (boost::filesystem::is_regular_file(inc_path, ec)) {
+            auto archive = std::make_shared<include_archive>();
+            if (!archive->open(inc_path)) {
+                return false;
+            }
+            for (std::size_t i = 0; i < archive->roots().size(); ++i) {
+                include_paths.push_back(
+                    {inc_path / std::to_string(i), archive->roots()[i], archive, i});
+            }
+            continue;
+        }
+        if (!boost::filesystem::is_directory(inc_path, ec)) {
+            spdlog::error("Include path is not a directory: {}", inc_path.string());
+            return false;
+        }
+        include_paths.push_back({inc_path, inc_path_raw});
+    }
+    return true;
+}
+
+bool write_include_archive(const std::vector<std::string>& include_paths_raw,
+                           const std::string& archive_file_raw) {
+    boost::system::error_code ec;
+    const auto archive_path = boost::filesystem::weakly_canonical(archive_file_raw, ec);
+    std::string contents;
+    std::string index;
+    cache_io::put_u64(index, include_paths_raw.size());
+    std::size_t file_count = 0;
+    for (const auto& inc_path_raw : include_paths_raw) {
+        const auto inc_path = boost::filesystem::canonical(inc_path_raw, ec);
+        if (ec) {
+            spdlog::error("Failed to resolve include path '{}': {}", inc_path_raw, ec.message());
+            return false;
+        }
+        if (!boost::filesystem::is_directory(inc_path, ec)) {
+            spdlog::error("Include path is not a directory: {}", inc_path.string());
+            return false;
+        }
+        std::vector<std::string> files;
+        for (boost::filesystem::recursive_directory_iterator it(inc_path, ec), end;
+             !ec && it != end; it.increment(ec)) {
+            boost::system::error_code status_ec;
+            if (boost::filesystem::is_regular_file(it->status(status_ec)) &&
+                it->path() != archive_path) {
+                files.push_back(it->path().lexically_relative(inc_path).generic_string());
+            }
+        }
+        if (ec) {
+            spdlog::error("Failed to list include path '{}': {}", inc_path_raw, ec.message());
+            return false;
+        }
+        std::sort(files.begin(), files.end());
+
+        cache_io::put_string(index, inc_path_raw);
+        cache_io::put_u64(index, files.size());
+        for (const auto& file : files) {
+            const auto file_path = (inc_path / file).string();
+            file_buffer buffer;
+            if (!buffer.open(file_path.c_str())) {
+                spdlog::error("Failed to read file: {}", file_path);
+                return false;
+            }
+            cache_io::put_string(index, file);
+            cache_io::put_u64(index, contents.size());
+            cache_io::put_u64(index, buffer.view().size());
+            cache_io::put_u64(index, hash_bytes(buffer.view()));
+            contents.append(buffer.view());
+        }
+        file_count += files.size();
+    }
+
+    std::string archive;
+    cache_io::put_string(archive, include_archive::magic);
+    cache_io::put_u64(archive, include_archive::version);
+    cache_io::put_string(archive, contents);
+    archive += index;
+    cache_io::put_u64(archive, hash_bytes(archive));
+    output_sink sink;
+    output_buffer result;
+    result << archive;
+    if (!write_output(archive_file_raw, sink, result)) {
+        return false;
+    }
+    spdlog::info("Packed {} files from {} include paths", file_count, include_paths_raw.size());
+    return true;
+}
+
+}  // namespace cequip::internal
@@ -0,0 +1,41 @@
+#include "internal/hooks.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <iterator>
+
+namespace cequip::internal {
+
+bool is_standard_library_header(std::string_view header) {
+    static constexpr std::string_view headers[] = {
+        "algorithm", "any", "array", "atomic", "barrier", "bit", "bitset", "cctype", "cerrno",
+        "cfenv", "cfloat", "charconv", "chrono", "cinttypes", "climits", "clocale", "cmath",
+        "codecvt", "compare", "complex", "concepts", "condition_variable", "coroutine", "csetjmp",
+        "csignal", "cstdarg", "cstddef", "cstdint", "cstdio", "cstdlib", "cstring", "ctime",
+        "cuchar", "cwchar", "cwctype", "deque", "exception", "execution", "expected", "filesystem",
+        "format", "forward_list", "fstream", "functional", "future", "initializer_list", "iomanip",
+        "ios", "iosfwd", "iostream", "istream", "iterator", "latch", "limits", "list", "locale",
+        "map", "memory", "memory_resource", "mutex", "new", "numbers", "numeric", "optional",
+        "ostream", "queue", "random", "ranges", "ratio", "regex", "scoped_allocator", "semaphore",
+        "set", "shared_mutex", "source_location", "span", "sstream", "stack", "stdexcept",
+        "stop_token", "streambuf", "string", "string_view", "syncstream", "system_error", "thread",
+        "tuple", "type_traits", "typeindex", "typeinfo", "unordered_map", "unordered_set",
+        "utility", "valarray", "variant", "vector", "version"};
+    static_assert(std::is_sorted(std::begin(headers), std::end(headers)));
+    return std::binary_search(std::begin(headers), std::end(headers), header);
+}
+
+bool configures_system_headers(std::string_view name) {
+    if (name == "NDEBUG" || name == "NOMINMAX" || name == "UNICODE" ||
+        name == "WIN32_LEAN_AND_MEAN") {
+        return true;
+    }
+    return name.size() > 1 && name[0] == '_' &&
+           (name[1] == '_' || std::isupper(static_cast<unsigned char>(name[1])));
+}
+
+std::string system_include_line(std::string_view header) {
+    return fmt::format("#include <{}>\n", header);
+}
+
+}  // namespace cequip::internal
@@ -0,0 +1,26 @@
+#pragma once
+
+#include "internal/common.hpp"
+#include "internal/preprocess.hpp"
+
+#include <string>
+#include <vector>
+
+// Running the jobs of a command line: up-to-date checks, output and depfiles.
+namespace cequip::internal {
+
+// Depfile of a job: the one given with --depfile, or the output's name with .d appended under
+// --md. Empty if none is wanted.
+std::string depfile_path(const run_config& config, const batch_job& job);
+
+// Writes a Make rule naming every file target was built from, as compilers do for -MD -MF.
+bool write_depfile(const std::string& depfile, const std::string& target,
+                   std::vector<std::string> dependencies);
+
+bool process_job(const run_config& config, const batch_job& job, const shared_setup& setup,
+                 std::uintmax_t& input_bytes, bool stream_console = true);
+
+bool run_batch(const run_config& config, const std::vector<batch_job>& jobs,
+               const shared_setup& setup);
+
+}  // namespace cequip::internal
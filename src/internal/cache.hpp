@@ -0,0 +1,264 @@
+#pragma once
+
+#include "internal/common.hpp"
+#include "internal/file_system.hpp"
+
+#include <spdlog/spdlog.h>
+
+#include <boost/filesystem.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/unordered/unordered_flat_map.hpp>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// The header cache, which keeps the output and macro state of included headers across runs, in
+// memory and on disk.
+namespace cequip::internal {
+
+struct cached_token {
+    std::uint32_t id;
+    std::string value;
+};
+
+// Everything an included file does besides emitting text, in the order it happened. Replaying
+// these against a fresh context reproduces the state an uncached run would have left behind.
+struct cache_event {
+    enum class kind : std::uint8_t {
+        dependency,
+        resolved_path,
+        define,
+        undef,
+        include_guard,
+        system_include,
+        predefine,  // A prelude snapshot's -d definition, which stays undefinable.
+        hoist_barrier,  // A directive that system includes are not hoisted across.
+        skipped_include,  // A nested include left out for its include guard or #pragma once.
+        // A path a nested include was looked up at and not found, from an include path before
+        // the one it was found in or from all of them. A file added there would be found instead.
+        missing_include,
+    };
+
+    kind type;
+    std::string name{};
+    std::string value{};
+    std::uint64_t content_hash = 0;
+    std::uint64_t offset = 0;
+    std::uint32_t line = 0;
+    std::uint32_t column = 0;
+    bool is_functionlike = false;
+    bool emitted = false;
+    std::vector<cached_token> parameters{};
+    std::vector<cached_token> definition{};
+};
+
+struct cached_header {
+    std::vector<cache_event> events;
+    std::string text;
+};
+
+// What an output file was built from: the content hash of every file read and the modification
+// time of every directory an include was looked up in, so that a new header shadowing an old
+// one is noticed as well.
+struct output_record {
+    std::uint64_t output_hash = 0;
+    std::vector<std::pair<std::string, std::uint64_t>> files{};
+    std::vector<std::pair<std::string, std::int64_t>> directories{};
+};
+
+class header_cache : boost::noncopyable {
+    static constexpr std::string_view magic = "CEQUIP-HEADER-CACHE-4";
+
+    boost::filesystem::path dir;
+    std::uint64_t config_key;
+    std::uintmax_t max_disk_bytes;
+    std::size_t max_memory_bytes;
+
+    struct memory_entry {
+        cached_header header;
+        std::size_t size = 0;
+        std::list<std::uint64_t>::iterator use;
+    };
+
+    mutable std::mutex memory_mutex;
+    mutable boost::unordered_flat_map<std::uint64_t, memory_entry> memory;
+    mutable std::list<std::uint64_t> memory_uses;  // Most recently used first.
+    mutable std::size_t memory_bytes = 0;
+
+    // Keeps entry in memory, dropping the least recently used entries beyond max_memory_bytes.
+    // Expects memory_mutex to be held; false if key is there already or entry does not fit.
+    bool remember(std::uint64_t key, const cached_header& entry) const;
+
+    boost::filesystem::path entry_path(std::uint64_t key) const {
+        return dir / fmt::format("{:016x}.ceq", key);
+    }
+
+    boost::filesystem::path record_path(std::uint64_t key) const {
+        return dir / fmt::format("{:016x}.ceqr", key);
+    }
+
+    bool write_file(std::uint64_t key, const std::string& data,
+                    const boost::filesystem::path& path) const;
+
+   public:
+    std::atomic<std::uint64_t> hits = 0;
+    std::atomic<std::uint64_t> misses = 0;
+    std::atomic<std::uint64_t> stores = 0;
+
+    // An empty cache_dir keeps entries in memory only. A run that stored entries on disk prunes
+    // the least recently used ones until the directory fits in max_disk_bytes again.
+    header_cache(boost::filesystem::path cache_dir, std::uint64_t cache_config_key,
+                 std::uintmax_t cache_max_disk_bytes = std::numeric_limits<std::uintmax_t>::max(),
+                 std::size_t cache_max_memory_bytes = std::numeric_limits<std::size_t>::max())
+        : dir(std::move(cache_dir)),
+          config_key(cache_config_key),
+          max_disk_bytes(cache_max_disk_bytes),
+          max_memory_bytes(cache_max_memory_bytes) {}
+
+    ~header_cache() {
+        if (!dir.empty() && stores > 0) {
+            prune();
+        }
+    }
+
+    void prune() const;
+
+    std::uint64_t make_key(const std::string& file, std::uint64_t content_hash,
+                           std::uint64_t macro_state_hash, std::size_t include_depth) const {
+        auto key = hash_combine(config_key, hash_bytes(file));
+        key = hash_combine(key, content_hash);
+        key = hash_combine(key, macro_state_hash);
+        return hash_combine(key, include_depth);
+    }
+
+    bool load(std::uint64_t key, cached_header& entry) const;
+    void store(std::uint64_t key, const cached_header& entry);
+    // Drops an entry recorded from files that have changed since, so that it can be stored anew.
+    void forget(std::uint64_t key);
+
+    // Output records are kept on disk only, one per combination of input, output and options.
+    std::uint64_t make_record_key(const std::string& input, const std::string& output,
+                                  std::uint64_t options) const {
+        return hash_combine(hash_combine(hash_combine(config_key, hash_bytes(input)),
+                                         hash_bytes(output)),
+                            options);
+    }
+
+    bool load_record(std::uint64_t key, output_record& record) const;
+    void store_record(std::uint64_t key, const output_record& record) const;
+};
+
+namespace cache_io {
+
+inline void put_u64(std::string& out, std::uint64_t value) {
+    for (int i = 0; i < 8; ++i) {
+        out.push_back(static_cast<char>((value >> (i * 8)) & 0xff));
+    }
+}
+
+inline void put_string(std::string& out, std::string_view value) {
+    put_u64(out, value.size());
+    out.append(value);
+}
+
+inline void put_tokens(std::string& out, const std::vector<cached_token>& tokens) {
+    put_u64(out, tokens.size());
+    for (const auto& tok : tokens) {
+        put_u64(out, tok.id);
+        put_string(out, tok.value);
+    }
+}
+
+inline void put_events(std::string& out, const std::vector<cache_event>& events) {
+    put_u64(out, events.size());
+    for (const auto& event : events) {
+        put_u64(out, static_cast<std::uint64_t>(event.type));
+        put_string(out, event.name);
+        put_string(out, event.value);
+        put_u64(out, event.content_hash);
+        put_u64(out, event.offset);
+        put_u64(out, event.line);
+        put_u64(out, event.column);
+        put_u64(out, event.is_functionlike);
+        put_u64(out, event.emitted);
+        put_tokens(out, event.parameters);
+        put_tokens(out, event.definition);
+    }
+}
+
+struct reader {
+    std::string_view data;
+    bool ok = true;
+
+    std::uint64_t u64() {
+        if (data.size() < 8) {
+            ok = false;
+            return 0;
+        }
+        std::uint64_t value = 0;
+        for (int i = 0; i < 8; ++i) {
+            value |= static_cast<std::uint64_t>(static_cast<unsigned char>(data[i])) << (i * 8);
+        }
+        data.remove_prefix(8);
+        return value;
+    }
+
+    std::string string() {
+        const auto size = u64();
+        if (!ok || data.size() < size) {
+            ok = false;
+            return {};
+        }
+        std::string value(data.substr(0, size));
+        data.remove_prefix(size);
+        return value;
+    }
+
+    std::vector<cached_token> tokens() {
+        std::vector<cached_token> result;
+        const auto count = u64();
+        for (std::uint64_t i = 0; ok && i < count; ++i) {
+            const auto id = static_cast<std::uint32_t>(u64());
+            result.push_back({id, string()});
+        }
+        return result;
+    }
+
+    std::vector<cache_event> events() {
+        std::vector<cache_event> result;
+        const auto count = u64();
+        for (std::uint64_t i = 0; ok && i < count; ++i) {
+            cache_event event;
+            event.type = static_cast<cache_event::kind>(u64());
+            event.name = string();
+            event.value = string();
+            event.content_hash = u64();
+            event.offset = u64();
+            event.line = static_cast<std::uint32_t>(u64());
+            event.column = static_cast<std::uint32_t>(u64());
+            event.is_functionlike = u64() != 0;
+            event.emitted = u64() != 0;
+            event.parameters = tokens();
+            event.definition = tokens();
+            result.push_back(std::move(event));
+        }
+        return result;
+    }
+};
+
+}  // namespace cache_io
+
+boost::filesystem::path default_cache_dir();
+
+// Everything that changes the emitted text of a header regardless of its own contents.
+std::uint64_t make_cache_config_key(const run_config& config,
+                                    const include_list_type& include_paths,
+                                    const std::vector<std::string>& predefined_macros,
+                                    std::uint64_t prelude_hash = 0);
+
+}  // namespace cequip::internal
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "internal/common.hpp"
+
+#include <boost/wave/language_support.hpp>
+#include <string>
+#include <vector>
+
+// The command line of cequip.
+namespace cequip::internal {
+
+// Returns false if the program is done, as after --help or a usage error, and is to exit with
+// exit_code. With usage_error set, the error is stored there instead of being printed.
+bool parse_cli(int argc, char** argv, run_config& config, int& exit_code,
+               std::string* usage_error = nullptr);
+
+void configure_logging(const run_config& config);
+
+boost::wave::language_support parse_language(const std::string& lang_str);
+
+eol_type parse_eol(const std::string& eol_value);
+
+std::vector<std::string> make_predefined_macros(const run_config& config);
+
+// See cequip::run_command_line().
+int run_command_line(int argc, char** argv);
+
+}  // namespace cequip::internal
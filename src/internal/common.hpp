@@ -0,0 +1,361 @@
+#pragma once
+
+#include <boost/filesystem.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/unordered/unordered_flat_set.hpp>
+#include <boost/wave/language_support.hpp>
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+// Internals of cequip shared by all of its parts: the run configuration, hashing, file contents,
+// keyword matching and the thread pools.
+namespace cequip::internal {
+
+enum class eol_type { as_is, native, lf, crlf };
+
+#if defined(_WIN32)
+inline constexpr char null_device[] = "NUL";
+#else
+inline constexpr char null_device[] = "/dev/null";
+#endif
+
+struct run_config {
+    bool version_flag;
+    bool quiet_flag;
+    bool remove_comments;
+    std::vector<std::string> kept_comment_patterns;
+    bool minify;
+    bool minify_macros;
+    bool tree_shake;
+    bool hoist_system_includes;
+    std::string system_include_umbrella;
+    bool expand_file_macros;
+    bool expand_line_macros;
+    bool expand_include_level_macros;
+    std::vector<std::string> input_files_raw;
+    std::string manifest_file_raw;
+    std::string matrix_file_raw;
+    std::string output_file_raw;
+    std::string output_dir_raw;
+    unsigned int jobs;
+    std::vector<std::string> include_paths_raw;
+    std::vector<std::string> definitions;
+    std::string lang_str;
+    boost::wave::language_support lang;
+    std::string eol_str;
+    eol_type eol;
+    std::string cache_dir_raw;
+    std::uintmax_t cache_size_mb;
+    bool no_cache;
+    bool watch;
+    std::string trace_file_raw;
+    std::string size_report_file_raw;
+    bool profile_macros;
+    std::string depfile_raw;
+    bool depfile_per_output;
+    std::string prelude_file_raw;
+    std::string prelude_snapshot_raw;
+    bool no_pass_through;
+    bool prefetch;
+    bool pack;
+    std::string pack_file_raw;
+    bool serve;
+    std::string socket_path_raw;
+};
+
+inline std::uint64_t hash_bytes(std::string_view bytes,
+                                std::uint64_t seed = 0xcbf29ce484222325ULL) {
+    for (const unsigned char ch : bytes) {
+        seed = (seed ^ ch) * 0x100000001b3ULL;
+    }
+    return seed;
+}
+
+inline std::uint64_t hash_combine(std::uint64_t seed, std::uint64_t value) {
+    seed ^= value + 0x9e3779b97f4a7c15ULL + (seed << 6) + (seed >> 2);
+    seed = (seed ^ (seed >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    seed = (seed ^ (seed >> 27)) * 0x94d049bb133111ebULL;
+    return seed ^ (seed >> 31);
+}
+
+// Read-only view of a file's bytes. Regular files are memory-mapped so the lexer reads straight
+// from the page cache; empty files, pipes and devices (which cannot be mapped) are read into
+// an owned string instead.
+class file_buffer : boost::noncopyable {
+    boost::interprocess::mapped_region region;
+    std::string fallback;
+    std::shared_ptr<const std::string> shared;
+    std::string_view contents;
+
+   public:
+    bool open(const char* file) {
+        boost::system::error_code ec;
+        const auto status = boost::filesystem::status(file, ec);
+        if (!ec && boost::filesystem::is_regular_file(status) &&
+            boost::filesystem::file_size(file, ec) > 0 && !ec) {
+            try {
+                const boost::interprocess::file_mapping mapping(file,
+                                                                boost::interprocess::read_only);
+                region = boost::interprocess::mapped_region(mapping,
+                                                            boost::interprocess::read_only);
+                region.advise(boost::interprocess::mapped_region::advice_sequential);
+                contents = {static_cast<const char*>(region.get_address()), region.get_size()};
+                return true;
+            } catch (const boost::interprocess::interprocess_exception&) {
+                // Fall back to reading the file below.
+            }
+        }
+        std::ifstream input(file, std::ios::binary);
+        if (!input.is_open()) {
+            return false;
+        }
+        fallback.assign(std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>());
+        contents = fallback;
+        return true;
+    }
+
+    // Views bytes owned by the caller, such as a library call's in-memory sources.
+    void assign(std::string_view bytes) { contents = bytes; }
+
+    // Views bytes shared with a file_cache, which stay alive for as long as this buffer.
+    void share(std::shared_ptr<const std::string> bytes) {
+        shared = std::move(bytes);
+        contents = *shared;
+    }
+
+    std::string_view view() const { return contents; }
+    const char* begin() const { return contents.data(); }
+    const char* end() const { return contents.data() + contents.size(); }
+};
+
+bool hash_file(const std::string& file, std::uint64_t& hash);
+
+// Finds any of a set of literal patterns in a text, ignoring ASCII case. The patterns are
+// compiled once into an Aho-Corasick automaton whose every state has a transition for every
+// byte, so a scan is one table load per byte and allocates nothing.
+class keyword_matcher {
+    // Entries are the offset of the next state's row, with the top bit set if it ends a match.
+    static constexpr std::uint32_t match_bit = 0x80000000u;
+    std::vector<std::uint32_t> table;
+    bool matches_empty = false;
+
+    static unsigned char fold(unsigned char ch) {
+        return ch >= 'A' && ch <= 'Z' ? static_cast<unsigned char>(ch - 'A' + 'a') : ch;
+    }
+
+   public:
+    explicit keyword_matcher(const std::vector<std::string>& patterns) {
+        // The trie of the case-folded patterns, where 0 is both the root and "no child".
+        std::vector<std::array<std::uint32_t, 256>> next(1);
+        std::vector<bool> ends(1);
+        for (const auto& pattern : patterns) {
+            std::uint32_t state = 0;
+            for (const char ch : pattern) {
+                auto& child = next[state][fold(static_cast<unsigned char>(ch))];
+                if (child == 0) {
+                    child = static_cast<std::uint32_t>(next.size());
+                    next.emplace_back();
+                    ends.push_back(false);
+                }
+                state = child;
+            }
+            ends[state] = true;
+        }
+        matches_empty = ends[0];
+
+        // Breadth first, so that the state a mismatch falls back to is complete before the
+        // states falling back to it borrow its transitions.
+        std::vector<std::uint32_t> fallback(next.size(), 0);
+        std::deque<std::uint32_t> queue;
+        for (const auto child : next[0]) {
+            if (child != 0) {
+                queue.push_back(child);
+            }
+        }
+        while (!queue.empty()) {
+            const auto state = queue.front();
+            queue.pop_front();
+            ends[state] = ends[state] || ends[fallback[state]];
+            for (std::size_t ch = 0; ch < 256; ++ch) {
+                auto& child = next[state][ch];
+                if (child != 0) {
+                    fallback[child] = next[fallback[state]][ch];
+                    queue.push_back(child);
+                } else {
+                    child = next[fallback[state]][ch];
+                }
+            }
+        }
+
+        table.resize(next.size() * 256);
+        for (std::size_t state = 0; state < next.size(); ++state) {
+            for (std::size_t ch = 0; ch < 256; ++ch) {
+                const auto target = next[state][fold(static_cast<unsigned char>(ch))];
+                table[state * 256 + ch] = target * 256 | (ends[target] ? match_bit : 0);
+            }
+        }
+    }
+
+    // Those that keep a comment unless told otherwise: license and copyright notices.
+    static const keyword_matcher& license_keywords() {
+        static const keyword_matcher matcher(
+            {"copyright", "license", "(c)", "all rights reserved", "©", "®"});
+        return matcher;
+    }
+
+    bool matches(std::string_view text) const {
+        std::uint32_t offset = 0;
+        for (const char ch : text) {
+            const auto entry = table[offset + static_cast<unsigned char>(ch)];
+            if ((entry & match_bit) != 0) {
+                return true;
+            }
+            offset = entry;
+        }
+        return matches_empty;
+    }
+};
+
+// Copies of the strings a run keeps until it ends, carved out of a few large blocks that are
+// all freed at once. Equal strings share one copy.
+class string_arena : boost::noncopyable {
+    std::pmr::monotonic_buffer_resource memory{16 * 1024};
+    boost::unordered_flat_set<std::string_view> interned;
+
+   public:
+    std::string_view intern(std::string_view text) {
+        if (auto it = interned.find(text); it != interned.end()) {
+            return *it;
+        }
+        auto* data = static_cast<char*>(memory.allocate(std::max<std::size_t>(text.size(), 1), 1));
+        std::copy(text.begin(), text.end(), data);
+        return *interned.insert(std::string_view(data, text.size())).first;
+    }
+};
+
+struct batch_job {
+    std::string input_file_raw;
+    std::string output_file_raw;
+};
+
+class work_stealing_pool : boost::noncopyable {
+    struct worker_queue {
+        std::mutex mutex;
+        std::deque<std::size_t> tasks;
+    };
+
+    std::vector<worker_queue> queues;
+
+    bool next_task(std::size_t worker, std::size_t& task) {
+        {
+            auto& own = queues[worker];
+            std::scoped_lock lock(own.mutex);
+            if (!own.tasks.empty()) {
+                task = own.tasks.back();
+                own.tasks.pop_back();
+                return true;
+            }
+        }
+        for (std::size_t offset = 1; offset < queues.size(); ++offset) {
+            auto& victim = queues[(worker + offset) % queues.size()];
+            std::scoped_lock lock(victim.mutex);
+            if (!victim.tasks.empty()) {
+                task = victim.tasks.front();
+                victim.tasks.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+
+   public:
+    explicit work_stealing_pool(std::size_t worker_count)
+        : queues(std::max<std::size_t>(worker_count, 1)) {}
+
+    std::size_t size() const { return queues.size(); }
+
+    // Runs fn(task) for every task in [0, task_count). Tasks are dealt round-robin to the
+    // workers, and a worker whose own queue runs dry steals from the other end of its peers'.
+    template <typename Fn>
+    void run(std::size_t task_count, Fn&& fn) {
+        for (std::size_t task = 0; task < task_count; ++task) {
+            queues[task % queues.size()].tasks.push_back(task);
+        }
+        std::vector<std::jthread> workers;
+        workers.reserve(queues.size());
+        for (std::size_t worker = 0; worker < queues.size(); ++worker) {
+            workers.emplace_back([this, worker, &fn] {
+                std::size_t task;
+                while (next_task(worker, task)) {
+                    fn(task);
+                }
+            });
+        }
+    }
+};
+
+// Runs tasks on a fixed set of worker threads in the order they were submitted. Tasks still
+// queued when it is destroyed are run first.
+class task_pool : boost::noncopyable {
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::deque<std::function<void()>> tasks;
+    bool stopping = false;
+    std::vector<std::jthread> workers;  // Last, so they are joined before the rest goes.
+
+    void work() {
+        while (true) {
+            std::function<void()> task;
+            {
+                std::unique_lock lock(mutex);
+                ready.wait(lock, [this] { return stopping || !tasks.empty(); });
+                if (tasks.empty()) {
+                    return;
+                }
+                task = std::move(tasks.front());
+                tasks.pop_front();
+            }
+            task();
+        }
+    }
+
+   public:
+    explicit task_pool(std::size_t worker_count) {
+        for (std::size_t i = 0; i < std::max<std::size_t>(worker_count, 1); ++i) {
+            workers.emplace_back([this] { work(); });
+        }
+    }
+
+    ~task_pool() {
+        {
+            std::scoped_lock lock(mutex);
+            stopping = true;
+        }
+        ready.notify_all();
+    }
+
+    void submit(std::function<void()> task) {
+        {
+            std::scoped_lock lock(mutex);
+            tasks.push_back(std::move(task));
+        }
+        ready.notify_one();
+    }
+};
+
+}  // namespace cequip::internal
@@ -0,0 +1,303 @@
+#pragma once
+
+#include "internal/common.hpp"
+
+#include <boost/filesystem.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/unordered/unordered_flat_map.hpp>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Finding and reading the files a run includes: the include paths, the directory index, the
+// file cache of a server, the sources of a library call and include archives.
+namespace cequip::internal {
+
+// Modification time of a directory at full precision, or 0 if there is none. Adding a file to
+// the directory or removing one changes it.
+std::int64_t directory_time(const std::string& dir);
+
+// In-memory listings of the directories includes are searched in. Each directory is read once,
+// when a lookup first reaches it, and later lookups below it are answered without filesystem
+// probes. Shared by all runs of a process; watch mode clears it before every rebuild.
+class include_index : boost::noncopyable {
+   public:
+    enum class entry_type : std::uint8_t { missing, file, directory, other };
+
+   private:
+    using listing = boost::unordered_flat_map<std::string, entry_type>;
+
+    struct stamped_listing {
+        std::shared_ptr<const listing> entries;
+        std::int64_t time = 0;  // Modification time of the directory when it was listed.
+        std::uint64_t checked = 0;  // Generation the time was last compared in.
+    };
+
+    std::mutex mutex;
+    boost::unordered_flat_map<std::string, stamped_listing> listings;
+    std::atomic<std::uint64_t> generation = 0;
+
+    static std::string entry_key(std::string name) {
+#if defined(_WIN32) || defined(__APPLE__)
+        // Match the default case-insensitive file systems of these platforms.
+        std::transform(name.begin(), name.end(), name.begin(),
+                       [](unsigned char ch) { return static_cast<char>(std::tolower(ch)); });
+#endif
+        return name;
+    }
+
+    std::shared_ptr<const listing> get_listing(const boost::filesystem::path& dir) {
+        const auto key = dir.string();
+        const auto current = generation.load();
+        std::shared_ptr<const listing> stale;
+        std::int64_t stale_time = 0;
+        {
+            std::scoped_lock lock(mutex);
+            if (auto it = listings.find(key); it != listings.end()) {
+                if (it->second.checked == current) {
+                    return it->second.entries;
+                }
+                stale = it->second.entries;
+                stale_time = it->second.time;
+            }
+        }
+        const auto time = directory_time(key);
+        if (stale != nullptr && time == stale_time) {
+            std::scoped_lock lock(mutex);
+            listings[key].checked = current;
+            return stale;
+        }
+
+        auto entries = std::make_shared<listing>();
+        boost::system::error_code ec;
+        for (boost::filesystem::directory_iterator it(dir, ec), end; !ec && it != end;
+             it.increment(ec)) {
+            boost::system::error_code status_ec;
+            const auto status = it->status(status_ec);
+            const auto type = boost::filesystem::is_regular_file(status) ? entry_type::file
+                              : boost::filesystem::is_directory(status) ? entry_type::directory
+                                                                        : entry_type::other;
+            entries->emplace(entry_key(it->path().filename().string()), type);
+        }
+        ++directories_listed;
+
+        std::scoped_lock lock(mutex);
+        auto& stamped = listings[key];
+        if (stamped.checked != current || stamped.entries == nullptr) {
+            stamped = {std::move(entries), time, current};
+        }
+        return stamped.entries;
+    }
+
+   public:
+    std::atomic<std::uint64_t> directories_listed = 0;
+    std::atomic<std::uint64_t> probes_saved = 0;
+
+    // Type of dir / relative, or nothing when the index cannot tell: dir must be absolute and
+    // relative a plain path without root, "." or ".." components.
+    std::optional<entry_type> lookup(const boost::filesystem::path& dir,
+                                     const std::string& relative) {
+        const boost::filesystem::path path(relative);
+        if (!dir.is_absolute() || path.empty() || path.has_root_path()) {
+            return std::nullopt;
+        }
+        for (const auto& part : path) {
+            if (part.empty() || part == "." || part == "..") {
+                return std::nullopt;
+            }
+        }
+
+        auto current = dir;
+        auto type = entry_type::directory;
+        for (const auto& part : path) {
+            if (type != entry_type::directory) {
+                type = entry_type::missing;
+                break;
+            }
+            const auto entries = get_listing(current);
+            const auto it = entries->find(entry_key(part.string()));
+            type = it != entries->end() ? it->second : entry_type::missing;
+            current /= part;
+        }
+        ++probes_saved;
+        return type;
+    }
+
+    void clear() {
+        std::scoped_lock lock(mutex);
+        listings.clear();
+    }
+
+    // Lets every listing be used again once its directory is seen to be unmodified since.
+    void revalidate() { ++generation; }
+};
+
+// Contents of the files read by the requests of a server, kept between them. An entry is used
+// for as long as the file has the modification time and size it had when it was read.
+class file_cache : boost::noncopyable {
+   public:
+    struct entry {
+        std::shared_ptr<const std::string> contents;
+        std::uint64_t content_hash = 0;
+        std::int64_t time = 0;
+        std::uintmax_t size = 0;
+    };
+
+   private:
+    std::mutex mutex;
+    boost::unordered_flat_map<std::string, entry> files;
+
+   public:
+    std::atomic<std::uint64_t> hits = 0;
+    std::atomic<std::uint64_t> misses = 0;
+
+    bool get(const std::string& file, entry& result) {
+        std::error_code ec;
+        const auto time = std::filesystem::last_write_time(file, ec);
+        const auto size = ec ? 0 : std::filesystem::file_size(file, ec);
+        const std::int64_t stamp = ec ? 0 : time.time_since_epoch().count();
+        if (!ec) {
+            std::scoped_lock lock(mutex);
+            if (auto it = files.find(file); it != files.end() && it->second.time == stamp &&
+                                            it->second.size == size) {
+                result = it->second;
+                ++hits;
+                return true;
+            }
+        }
+
+        // Devices and pipes have no meaningful stamp, so they are read every time.
+        file_buffer buffer;
+        if (!buffer.open(file.c_str())) {
+            return false;
+        }
+        ++misses;
+        result = {std::make_shared<const std::string>(buffer.view()), hash_bytes(buffer.view()),
+                  stamp, size};
+        if (!ec && std::filesystem::is_regular_file(file, ec)) {
+            std::scoped_lock lock(mutex);
+            files.insert_or_assign(file, result);
+        }
+        return true;
+    }
+};
+
+// The sources of a library call, which stand in for the disk. Paths are made absolute against
+// the root and normalized, the form Wave hands them back in.
+class memory_file_system : boost::noncopyable {
+    boost::unordered_flat_map<std::string, std::string_view> files;
+
+   public:
+    // path taken relative to base unless it is absolute.
+    static boost::filesystem::path normalize(std::string_view path,
+                                             const boost::filesystem::path& base = "/") {
+        const boost::filesystem::path relative(path.begin(), path.end());
+        return (relative.has_root_directory() ? relative : base / relative).lexically_normal();
+    }
+
+    void add(std::string_view path, std::string_view contents) {
+        files.insert_or_assign(normalize(path).string(), contents);
+    }
+
+    const std::string_view* find(const boost::filesystem::path& path) const {
+        const auto it = files.find(path.string());
+        return it != files.end() ? &it->second : nullptr;
+    }
+};
+
+// Include roots packed into a single file by `cequip pack`, which is mapped into memory once
+// and read from there. Layout: magic, format version, the contents of all files, the roots in
+// order (name as given to -i, then per file its relative path, offset into the contents, size
+// and content hash) and last a checksum of everything before it.
+class include_archive : boost::noncopyable {
+   public:
+    static constexpr std::string_view magic = "CEQUIP-PACK";
+    static constexpr std::uint64_t version = 1;
+
+    struct member {
+        std::string_view contents;
+        std::uint64_t content_hash = 0;
+    };
+
+   private:
+    boost::filesystem::path file;
+    file_buffer buffer;
+    std::vector<std::string> root_names;
+    std::vector<boost::unordered_flat_map<std::string, member>> members;
+    std::pair<std::int64_t, std::uintmax_t> opened_stamp;
+    mutable std::once_flag hashed;
+    mutable std::uint64_t file_hash = 0;
+
+    std::pair<std::int64_t, std::uintmax_t> stamp() const {
+        std::error_code ec;
+        const auto time = std::filesystem::last_write_time(file.string(), ec);
+        const auto size = ec ? 0 : std::filesystem::file_size(file.string(), ec);
+        return {ec ? 0 : time.time_since_epoch().count(), ec ? 0 : size};
+    }
+
+   public:
+    bool open(const boost::filesystem::path& archive_file);
+
+    // Whether the file still has the modification time and size it had when it was opened.
+    bool unchanged() const { return stamp() == opened_stamp; }
+
+    const boost::filesystem::path& path() const { return file; }
+    const std::vector<std::string>& roots() const { return root_names; }
+
+    // Hash of the whole archive as mapped, like hash_file() would compute it.
+    std::uint64_t content_hash() const {
+        std::call_once(hashed, [this] { file_hash = hash_bytes(buffer.view()); });
+        return file_hash;
+    }
+
+    // The file at relative below a root, which like a lookup in a directory may not leave it.
+    const member* find(std::size_t root, const boost::filesystem::path& relative) const {
+        const auto normal = relative.lexically_normal();
+        if (normal.empty() || normal.has_root_path() || *normal.begin() == "..") {
+            return nullptr;
+        }
+        const auto it = members[root].find(normal.generic_string());
+        return it != members[root].end() ? &it->second : nullptr;
+    }
+};
+
+// An include path. Roots packed into an archive live at the archive's path / the root's index.
+struct include_root {
+    boost::filesystem::path dir;
+    std::string dir_raw;
+    std::shared_ptr<const include_archive> archive{};
+    std::size_t archive_root = 0;
+};
+
+using include_list_type = std::deque<include_root>;
+
+// The archived include root that path, a normalized absolute path, lies in.
+const include_root* find_archive_root(const std::deque<include_root>& include_paths,
+                                      const boost::filesystem::path& path,
+                                      boost::filesystem::path& relative);
+
+const include_archive::member* find_archived(const std::deque<include_root>& include_paths,
+                                             const boost::filesystem::path& path);
+
+bool resolve_input_path(const std::string& input_file_raw, boost::filesystem::path& path);
+
+bool load_file_contents(const boost::filesystem::path& path, file_buffer& contents);
+
+bool resolve_include_paths(const std::vector<std::string>& include_paths_raw,
+                           include_list_type& include_paths);
+
+// Writes every file below the include paths into an archive, in the layout include_archive
+// reads. Files are stored in path order, so packing the same files again gives the same bytes.
+bool write_include_archive(const std::vector<std::string>& include_paths_raw,
+                           const std::string& archive_file_raw);
+
+}  // namespace cequip::internal
@@ -0,0 +1,1558 @@
+#pragma once
+
+#include "internal/cache.hpp"
+#include "internal/common.hpp"
+#include "internal/file_system.hpp"
+#include "internal/output.hpp"
+#include "internal/raw_scanner.hpp"
+#include "internal/report.hpp"
+
+#include <spdlog/spdlog.h>
+
+#include <boost/filesystem.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/unordered/unordered_flat_map.hpp>
+#include <boost/unordered/unordered_flat_set.hpp>
+#include <boost/wave.hpp>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// The Wave hooks of a run and the state they write the output from.
+namespace cequip::internal {
+
+// Headers of the C++ standard library that an umbrella header like bits/stdc++.h includes.
+// cassert is left out: each inclusion of it takes NDEBUG afresh.
+bool is_standard_library_header(std::string_view header);
+
+// Macros that system headers read to configure themselves: NDEBUG, a few Windows switches and
+// the reserved names, like _GNU_SOURCE or __STDC_FORMAT_MACROS.
+bool configures_system_headers(std::string_view name);
+
+inline bool is_word_char(char ch) {
+    return std::isalnum(static_cast<unsigned char>(ch)) || ch == '_' || ch == '$' ||
+           static_cast<unsigned char>(ch) >= 0x80;
+}
+
+inline bool starts_number(std::string_view token) {
+    return std::isdigit(static_cast<unsigned char>(token.front())) ||
+           (token.size() > 1 && token[0] == '.' &&
+            std::isdigit(static_cast<unsigned char>(token[1])));
+}
+
+// Whether two tokens written back to back would lex differently than with a space between
+// them: identifiers, numbers and literal prefixes or suffixes merge, a number absorbs a
+// following '.', '+' or '-', and operator characters can form longer operators, digraphs or
+// comments.
+inline bool needs_separator(char before, bool before_number, char after) {
+    static constexpr std::string_view operator_chars = "+-*/%<>=!&|^:.#?";
+    if (is_word_char(before) && (is_word_char(after) || after == '"' || after == '\'')) {
+        return true;
+    }
+    if ((before == '"' || before == '\'') && is_word_char(after)) {
+        return true;
+    }
+    if (before_number && (after == '.' || after == '+' || after == '-')) {
+        return true;
+    }
+    return operator_chars.contains(before) && operator_chars.contains(after);
+}
+
+std::string system_include_line(std::string_view header);
+
+// Where a run looks for the files it includes: the include paths, the directory index, and the
+// in-memory sources or file cache read in place of the disk.
+struct include_resolver : boost::noncopyable {
+    // Resolved once in main() and shared read-only by every run.
+    const include_list_type* include_paths = nullptr;
+    include_index* includes = nullptr;
+    const memory_file_system* files = nullptr;  // Read instead of the disk if set.
+    file_cache* loaded_files = nullptr;  // Files kept in memory between runs, if set.
+
+    // Includes resolved so far, by the directory they were found from and the header name as
+    // written. Headers included over and over, as behind include guards, are resolved once.
+    struct resolved_include {
+        bool found = false;
+        std::string_view file_path;
+        std::string_view dir_path;
+        std::size_t first_missing = 0;  // The range of missing paths it was looked up at.
+        std::size_t last_missing = 0;
+    };
+    boost::unordered_flat_map<std::string_view, resolved_include> resolved_includes;
+    std::string resolve_key;  // Reused, so that keys are built without allocating.
+    // The index of the include path each file was found in, for #include_next.
+    boost::unordered_flat_map<std::string_view, std::size_t> include_path_of;
+    // Wave's current directory of every open file, which Wave itself only hands out by copy.
+    std::vector<std::string_view> current_directories;
+    // The paths includes were looked up at and not found, in the order they were, while
+    // track_missing is set. A file added at one of them would shadow the one found after it.
+    bool track_missing = false;
+    std::vector<std::string_view> missing;
+
+    explicit include_resolver(string_arena& arena) : strings(arena) {}
+
+    void note_missing(const boost::filesystem::path& candidate) {
+        if (track_missing) {
+            missing.push_back(strings.intern(candidate.string()));
+        }
+    }
+
+    // Whether path, looked up at before, is still not there.
+    bool still_missing(const std::string& path) const {
+        const boost::filesystem::path candidate(path);
+        return find_archived(candidate) == nullptr &&
+               !is_file(candidate.parent_path(), candidate.filename().string());
+    }
+
+    bool is_file(const boost::filesystem::path& dir, const std::string& file_path) const {
+        if (files != nullptr) {
+            return files->find(memory_file_system::normalize(file_path, dir)) != nullptr;
+        }
+        const auto type = includes != nullptr ? includes->lookup(dir, file_path) : std::nullopt;
+        if (type) {
+            return *type == include_index::entry_type::file;
+        }
+        boost::system::error_code ec;
+        return boost::filesystem::is_regular_file(dir / file_path, ec);
+    }
+
+    const include_root* find_archive_root(const boost::filesystem::path& path,
+                                          boost::filesystem::path& relative) const {
+        return include_paths != nullptr
+                   ? internal::find_archive_root(*include_paths, path, relative)
+                   : nullptr;
+    }
+
+    const include_archive::member* find_archived(const boost::filesystem::path& path) const {
+        return include_paths != nullptr ? internal::find_archived(*include_paths, path) : nullptr;
+    }
+
+    // The directory whose listing decides whether path is there: the archive it is in, if any.
+    std::string lookup_directory(const std::string& path) const {
+        boost::filesystem::path relative;
+        const auto* root = find_archive_root(path, relative);
+        return root != nullptr ? root->archive->path().string()
+                               : boost::filesystem::path(path).parent_path().string();
+    }
+
+    // The file a build depends on for path: the archive it was read from, if any.
+    std::string dependency_path(const std::string& path) const {
+        boost::filesystem::path relative;
+        const auto* root = find_archive_root(path, relative);
+        return root != nullptr ? root->archive->path().string() : path;
+    }
+
+    // For #include_next, current_file is the including file and the search starts after the
+    // include path it was found in. A file not found in one, such as the main file, starts it
+    // after the first include path it lies under, as Wave does.
+    bool find_in_include_paths(std::string& file_path, std::string& dir_path,
+                               char const* current_file = nullptr) {
+        if (include_paths == nullptr) {
+            return false;
+        }
+        std::size_t first = 0;
+        if (current_file != nullptr) {
+            if (auto it = include_path_of.find(std::string_view(current_file));
+                it != include_path_of.end()) {
+                first = it->second + 1;
+            } else {
+                const auto current = boost::filesystem::path(current_file).lexically_normal();
+                for (std::size_t i = 0; i < include_paths->size(); ++i) {
+                    const auto relative = current.lexically_relative((*include_paths)[i].dir);
+                    if (!relative.empty() && *relative.begin() != "..") {
+                        first = i + 1;
+                        break;
+                    }
+                }
+            }
+        }
+        for (std::size_t i = first; i < include_paths->size(); ++i) {
+            const auto& [dir, dir_raw, archive, archive_root] = (*include_paths)[i];
+            const auto candidate = (dir / file_path).lexically_normal();
+            const bool exists = archive != nullptr
+                                    ? archive->find(archive_root, file_path) != nullptr
+                                    : is_file(dir, file_path);
+            if (!exists) {
+                note_missing(candidate);
+            } else if (current_file == nullptr || candidate != current_file) {
+                dir_path = (boost::filesystem::path(dir_raw) / file_path).string();
+                file_path = candidate.string();
+                include_path_of.try_emplace(strings.intern(file_path), i);
+                return true;
+            }
+        }
+        return false;
+    }
+
+   private:
+    string_arena& strings;
+};
+
+// Header cache bookkeeping, all of it inactive while cache is null. Every included file opens a
+// frame; the frames of files missing from the cache record the output and events written
+// while they are open.
+struct header_recorder : boost::noncopyable {
+    struct frame {
+        std::string file;
+        std::uint64_t content_hash = 0;
+        std::uint64_t key = 0;
+        bool recording = false;
+        std::size_t output_begin = 0;
+        std::size_t event_begin = 0;
+    };
+
+    header_cache* cache = nullptr;
+    bool replaying = false;
+    std::uint64_t macro_state_hash = 0;
+    boost::unordered_flat_map<std::string, std::uint64_t> macro_hashes;
+    boost::unordered_flat_map<std::string, std::uint64_t> content_hashes;
+    frame pending_frame;  // Opened by the next file Wave opens.
+    std::vector<std::pair<std::uint64_t, cached_header>> recorded_headers;
+    std::optional<std::size_t> last_recorded;
+
+    header_recorder(output_buffer& output, const include_resolver& includes)
+        : result(output), resolver(includes) {}
+
+    bool get_content_hash(const std::string& file, std::uint64_t& hash) {
+        if (auto it = content_hashes.find(file); it != content_hashes.end()) {
+            hash = it->second;
+            return true;
+        }
+        if (const auto* member = resolver.find_archived(file)) {
+            hash = member->content_hash;
+            return true;
+        }
+        if (file_cache::entry entry;
+            resolver.loaded_files != nullptr && resolver.loaded_files->get(file, entry)) {
+            hash = entry.content_hash;
+            content_hashes.emplace(file, hash);
+            return true;
+        }
+        if (!hash_file(file, hash)) {
+            return false;
+        }
+        content_hashes.emplace(file, hash);
+        return true;
+    }
+
+    bool dependencies_unchanged(const cached_header& entry) {
+        for (const auto& event : entry.events) {
+            std::uint64_t hash;
+            if (event.type == cache_event::kind::dependency &&
+                (!get_content_hash(event.name, hash) || hash != event.content_hash)) {
+                return false;
+            }
+            if (event.type == cache_event::kind::missing_include &&
+                !resolver.still_missing(event.name)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void log_event(cache_event event) {
+        if (recording_frames > 0) {
+            events.push_back(std::move(event));
+        }
+    }
+
+    // Logs the paths an include was looked up at and not found, from first to last.
+    void log_missing(std::size_t first, std::size_t last) {
+        for (std::size_t i = first; i < last && recording_frames > 0; ++i) {
+            log_event({.type = cache_event::kind::missing_include,
+                       .name = std::string(resolver.missing[i])});
+        }
+    }
+
+    void record_include_guard(const std::string& file, const std::string& guard_name) {
+        cache_event event{
+            .type = cache_event::kind::include_guard, .name = file, .value = guard_name};
+        // Wave reports a file's include guard only after returning from it, so attach it to the
+        // entry that was just closed as well as to the still open parents.
+        if (last_recorded && last_recorded_file == file) {
+            recorded_headers[*last_recorded].second.events.push_back(event);
+        }
+        last_recorded.reset();
+        log_event(std::move(event));
+    }
+
+    void open_frame() {
+        auto opened = std::exchange(pending_frame, {});
+        last_recorded.reset();
+        if (!opened.file.empty()) {
+            log_event({.type = cache_event::kind::dependency,
+                       .name = opened.file,
+                       .content_hash = opened.content_hash});
+        }
+        if (opened.recording) {
+            opened.output_begin = result.size();
+            if (recording_frames++ == 0) {
+                result.retain_from(opened.output_begin);
+            }
+            opened.event_begin = events.size();
+        }
+        frames.push_back(std::move(opened));
+    }
+
+    void close_frame() {
+        if (frames.empty()) {
+            return;
+        }
+        auto closed = std::move(frames.back());
+        frames.pop_back();
+        if (!closed.recording) {
+            return;
+        }
+
+        // Stored text leaves out system includes so a replay can decide afresh whether they are
+        // still needed; their events remember where they belong.
+        cached_header entry;
+        const auto output = result.view(closed.output_begin);
+        std::size_t copied = 0;
+        // Headers included over and over are looked up at the same missing paths each time.
+        boost::unordered_flat_set<std::string_view> missing;
+        for (std::size_t i = closed.event_begin; i < events.size(); ++i) {
+            if (events[i].type == cache_event::kind::missing_include &&
+                !missing.insert(events[i].name).second) {
+                continue;
+            }
+            auto event = events[i];
+            if (event.type == cache_event::kind::system_include) {
+                const auto offset = event.offset - closed.output_begin;
+                entry.text.append(output.substr(copied, offset - copied));
+                copied = offset;
+                if (event.emitted) {
+                    copied += system_include_line(event.name).size();
+                }
+                event.offset = entry.text.size();
+            }
+            entry.events.push_back(std::move(event));
+        }
+        entry.text.append(output.substr(copied));
+        recorded_headers.emplace_back(closed.key, std::move(entry));
+        last_recorded = recorded_headers.size() - 1;
+        last_recorded_file = std::move(closed.file);
+
+        if (--recording_frames == 0) {
+            events.clear();
+            result.retain_from(std::nullopt);
+        }
+    }
+
+   private:
+    output_buffer& result;
+    const include_resolver& resolver;
+    std::vector<cache_event> events;
+    std::vector<frame> frames;
+    std::size_t recording_frames = 0;
+    std::string last_recorded_file;
+};
+
+// System includes left in the output, each written once. With --system-include-umbrella the
+// standard library headers give way to the umbrella header; with --hoist-system-includes they
+// are collected to be written in front of the output while hoisting is set. The first
+// directive that may configure the headers included after it clears it; see stop_hoisting.
+struct system_include_writer : boost::noncopyable {
+    std::string_view umbrella;  // Included in place of every standard library header, if set.
+    bool hoist = false;
+    bool hoisting = false;
+    std::vector<std::string_view> hoisted;
+
+    system_include_writer(output_buffer& output, string_arena& arena, header_recorder& cache)
+        : result(output), strings(arena), recorder(cache) {}
+
+    void emit(std::string_view header) {
+        if (!umbrella.empty() && is_standard_library_header(header)) {
+            header = umbrella;
+        }
+        header = strings.intern(header);
+        const bool inserted = emitted.insert(header).second;
+        const bool hoisted_now = inserted && hoisting;
+        if (hoisted_now) {
+            hoisted.push_back(header);
+        }
+        if (recorder.cache != nullptr) {
+            recorder.log_event({.type = cache_event::kind::system_include,
+                                .name = std::string(header),
+                                .offset = result.size(),
+                                .emitted = inserted && !hoisted_now});
+        }
+        if (inserted && !hoisted_now) {
+            result << system_include_line(header);
+        }
+    }
+
+    // System includes that follow stay where they are, as the headers they name may depend on
+    // what the directive just seen configured.
+    void stop_hoisting() {
+        hoisting = false;
+        if (recorder.cache != nullptr) {
+            recorder.log_event({.type = cache_event::kind::hoist_barrier});
+        }
+    }
+
+   private:
+    output_buffer& result;
+    string_arena& strings;
+    header_recorder& recorder;
+    boost::unordered_flat_set<std::string_view> emitted;
+};
+
+// Trace bookkeeping, all of it inactive while trace is null. Every included file gets a frame
+// counting the tokens generated while it is open.
+struct include_tracer {
+    trace_recorder* trace = nullptr;
+    std::string root;
+    // The name and arguments of the frame of the next file Wave opens.
+    std::string next_include;
+    std::string next_include_args;
+    std::vector<std::uint64_t> frame_tokens;
+    std::uint64_t tokens = 0;
+
+    void open_frame(const std::string& name, std::string args = {}) {
+        trace->begin(name, "include", std::move(args));
+        frame_tokens.push_back(0);
+    }
+
+    void close_frame() {
+        const auto closed = frame_tokens.back();
+        frame_tokens.pop_back();
+        tokens += closed;
+        trace->end(fmt::format(R"({{"tokens": {}}})", closed));
+        trace->counter("tokens generated: " + root, tokens);
+    }
+};
+
+// Size attribution, all of it inactive while sizes is null. Output written since mark belongs
+// to the file on top of files.
+struct size_attribution {
+    size_report* sizes = nullptr;
+    std::vector<std::string> files;
+    std::size_t mark = 0;
+    size_report::file_map file_sizes;
+    size_report::macro_map macro_sizes;
+
+    void attribute(std::size_t output_size) {
+        file_sizes[files.back()] += output_size - mark;
+        mark = output_size;
+    }
+};
+
+// Macro profiling, all of it inactive while profile is null. Entries are kept by macro name,
+// file and line of the definition; expansions still being rescanned are on frames.
+struct macro_profiler : boost::noncopyable {
+    struct frame {
+        std::size_t entry;
+        std::chrono::steady_clock::time_point start;
+        std::chrono::nanoseconds nested{};
+    };
+    macro_profile* profile = nullptr;
+    std::vector<macro_profile::entry> entries;
+
+    explicit macro_profiler(string_arena& arena) : strings(arena) {}
+
+    template <typename TokenT>
+    void begin_expansion(TokenT const& macro_name) {
+        const auto& name = macro_name.get_value();
+        const auto& pos = macro_name.get_position();
+        const auto& file = pos.get_file();
+        const auto key = std::make_tuple(strings.intern({name.data(), name.size()}),
+                                         strings.intern({file.data(), file.size()}),
+                                         std::size_t{pos.get_line()});
+        const auto [it, inserted] = sites.try_emplace(key, entries.size());
+        if (inserted) {
+            entries.push_back(
+                {.name = std::string(std::get<0>(key)),
+                 .location = fmt::format("{}:{}", std::get<1>(key), std::get<2>(key))});
+        }
+        frames.push_back({it->second, std::chrono::steady_clock::now()});
+    }
+
+    template <typename ContainerT>
+    void end_expansion(ContainerT const& expanded) {
+        if (frames.empty()) {
+            return;
+        }
+        const auto ended = frames.back();
+        frames.pop_back();
+        const auto elapsed = std::chrono::steady_clock::now() - ended.start;
+        auto& entry = entries[ended.entry];
+        ++entry.expansions;
+        entry.tokens += expanded.size();
+        entry.total += elapsed;
+        entry.self += elapsed - ended.nested;
+        if (!frames.empty()) {
+            frames.back().nested += elapsed;
+        }
+    }
+
+   private:
+    string_arena& strings;
+    boost::unordered_flat_map<std::tuple<std::string_view, std::string_view, std::size_t>,
+                              std::size_t>
+        sites;
+    std::vector<frame> frames;
+};
+
+// --minify: whitespace between tokens is held back until the next token shows whether a
+// separator is needed. Directives and included files always start on a line of their own.
+struct minify_state {
+    static constexpr std::size_t max_line = 1000;
+    bool enabled = false;
+    bool macros = false;  // --minify-macros
+    bool pending_space = false;
+    bool last_token_number = false;
+    bool after_macro_name = false;
+    std::size_t macro_args_depth = 0;
+    std::size_t line_begin = 0;
+    std::uint64_t original_bytes = 0;
+    std::uint64_t written_bytes = 0;
+};
+
+// Raw pass-through: regions of the files being lexed are written verbatim in place of the
+// placeholders Wave is handed instead.
+struct raw_pass_through {
+    bool enabled = false;
+    std::vector<raw_region> regions;
+    int tokens_to_skip = 0;
+    // Where the directive last reported to found_directive starts.
+    std::string directive_file;
+    std::size_t directive_line = 0;
+};
+
+// Tree shaking bookkeeping. Output written while no included file is open, cached replays
+// included, comes from the main file.
+struct main_file_output {
+    std::size_t included_depth = 0;
+    std::size_t mark = 0;
+    std::vector<std::pair<std::size_t, std::size_t>> ranges;
+
+    void enter_include(std::size_t output_size) {
+        if (included_depth++ == 0) {
+            ranges.emplace_back(mark, output_size);
+        }
+    }
+
+    void leave_include(std::size_t output_size) {
+        if (--included_depth == 0) {
+            mark = output_size;
+        }
+    }
+};
+
+// The state of one run shared by its hooks and load policy, made of the parts above.
+struct hook_state : boost::noncopyable {
+    output_buffer& result;
+    string_arena strings;  // First, so the views into it below go before it does.
+    std::uint64_t unique_id = 0;
+    bool is_cpp = true;
+    bool processing_directive = false;
+    boost::unordered_flat_map<std::string_view, std::string_view> correct_paths;
+    bool remove_comments = false;
+    // Comments kept by --remove-comments and --minify.
+    const keyword_matcher* kept_comments = &keyword_matcher::license_keywords();
+    bool expand_file_macros = false;
+    bool expand_line_macros = false;
+    bool expand_include_level_macros = false;
+    eol_type eol = eol_type::as_is;
+    minify_state minify;
+    boost::unordered_flat_set<std::string> included_files;
+    // Directives of the current file so far and the macro of the #ifndef it started with, by
+    // which its include guard's #define is told apart from other definitions.
+    std::size_t file_directives = 0;
+    std::string guard_candidate;
+    phase_timings* timings = nullptr;
+    // Include guards seen, collected while building a prelude snapshot.
+    std::vector<std::pair<std::string, std::string>>* include_guards = nullptr;
+    bool tree_shake = false;
+    main_file_output main_output;
+
+    include_resolver resolver{strings};
+    header_recorder recorder{result, resolver};
+    system_include_writer system_includes{result, strings, recorder};
+    raw_pass_through raw;
+    include_tracer tracing;
+    size_attribution attribution;
+    macro_profiler profiler{strings};
+
+    explicit hook_state(output_buffer& output) : result(output) {}
+
+    std::string get_correct_path(const std::string& path) {
+        auto it = correct_paths.find(path);
+        if (it != correct_paths.end()) {
+            return std::string(it->second);
+        }
+        return path;
+    }
+
+    void write_newline(std::string_view original) {
+        if (eol == eol_type::as_is) {
+            result << original;
+        } else if (eol == eol_type::native) {
+#if defined(_WIN32)
+            result << "\r\n";
+#else
+            result << "\n";
+#endif
+        } else if (eol == eol_type::lf) {
+            result << "\n";
+        } else if (eol == eol_type::crlf) {
+            result << "\r\n";
+        }
+    }
+
+    // Ends the current line before a directive or an included file under --minify.
+    void begin_directive() {
+        if (minify.enabled && result.last_char() != '\n') {
+            write_newline("\n");
+        }
+        minify.pending_space = false;
+    }
+
+    void write_minified(std::string_view token) {
+        if (result.last_char() == '\n') {
+            minify.line_begin = result.size();
+        } else if (minify.pending_space) {
+            if (result.size() - minify.line_begin >= minify_state::max_line) {
+                write_newline("\n");
+                minify.line_begin = result.size();
+            } else if (minify.macro_args_depth > 0 ||
+                       needs_separator(result.last_char(), minify.last_token_number,
+                                       token.front())) {
+                // Inside the arguments of a macro call spaces are kept, as # would put them
+                // into the stringized text.
+                result << ' ';
+            }
+        }
+        minify.pending_space = false;
+        result << token;
+        minify.last_token_number = starts_number(token);
+    }
+
+    void enter_included_output() { main_output.enter_include(result.size()); }
+    void leave_included_output() { main_output.leave_include(result.size()); }
+    void attribute_output() { attribution.attribute(result.size()); }
+};
+
+class custom_hooks : public boost::wave::context_policies::default_preprocessing_hooks {
+    using base = boost::wave::context_policies::default_preprocessing_hooks;
+
+    hook_state& state;
+
+    template <typename ContainerT>
+    void log_container(ContainerT const& container) {
+        for (const auto& tok : container) {
+            if (!tok.is_valid()) {
+                continue;
+            }
+            state.result << tok.get_value();
+        }
+    }
+
+    template <typename TokenT>
+    static bool is_whitespace(TokenT const& token) {
+        const auto id = boost::wave::token_id(token);
+        return IS_CATEGORY(id, boost::wave::WhiteSpaceTokenType) ||
+               IS_CATEGORY(id, boost::wave::EOLTokenType);
+    }
+
+    // Replacement list of a #define under --minify. Whitespace runs become a single space, which
+    // never changes what the macro means; --minify-macros also drops the spaces that no token
+    // boundary needs, except within parentheses where they may end up stringized.
+    template <typename DefinitionT>
+    std::string minified_definition(DefinitionT const& definition) const {
+        std::string body;
+        bool space = false;
+        bool number = false;
+        std::size_t depth = 0;
+        for (const auto& tok : definition) {
+            const auto& value = tok.get_value();
+            if (!tok.is_valid() || value.empty()) {
+                continue;
+            }
+            if (is_whitespace(tok)) {
+                space = !body.empty();
+                continue;
+            }
+            if (space && (!state.minify.macros || depth > 0 ||
+                          needs_separator(body.back(), number, value[0]))) {
+                body += ' ';
+            }
+            space = false;
+            body.append(value.begin(), value.end());
+            number = starts_number(body.substr(body.size() - value.size()));
+            if (value == "(") {
+                ++depth;
+            } else if (value == ")" && depth > 0) {
+                --depth;
+            }
+        }
+        return body;
+    }
+
+    template <typename ContextT, typename TokenT>
+    void write_minified_token(ContextT const& ctx, TokenT const& token) {
+        const auto id = boost::wave::token_id(token);
+        const auto& value = token.get_value();
+        const auto output_begin = state.result.size();
+        if ((id == boost::wave::T_CCOMMENT || id == boost::wave::T_CPPCOMMENT) &&
+            is_kept_comment(value)) {
+            state.write_minified(std::string_view(value.data(), value.size()));
+            if (id == boost::wave::T_CPPCOMMENT && state.result.last_char() != '\n') {
+                state.write_newline("\n");
+            }
+        } else if (is_whitespace(token)) {
+            state.minify.pending_space = true;
+        } else if (!value.empty()) {
+            state.write_minified(std::string_view(value.data(), value.size()));
+            if (id == boost::wave::T_LEFTPAREN &&
+                (state.minify.after_macro_name || state.minify.macro_args_depth > 0)) {
+                ++state.minify.macro_args_depth;
+            } else if (id == boost::wave::T_RIGHTPAREN && state.minify.macro_args_depth > 0) {
+                --state.minify.macro_args_depth;
+            }
+            state.minify.after_macro_name =
+                id == boost::wave::T_IDENTIFIER && ctx.is_defined_macro(value);
+        }
+        state.minify.original_bytes += value.size();
+        state.minify.written_bytes += state.result.size() - output_begin;
+    }
+
+    template <typename ContainerT>
+    static std::vector<cached_token> to_cached_tokens(ContainerT const& container) {
+        std::vector<cached_token> tokens;
+        for (const auto& tok : container) {
+            const auto value = tok.get_value();
+            tokens.push_back({static_cast<std::uint32_t>(boost::wave::token_id(tok)),
+                              std::string(value.begin(), value.end())});
+        }
+        return tokens;
+    }
+
+    static std::uint64_t hash_macro(const cache_event& event) {
+        auto hash = hash_combine(hash_bytes(event.name), event.is_functionlike);
+        for (const auto* tokens : {&event.parameters, &event.definition}) {
+            hash = hash_combine(hash, tokens->size());
+            for (const auto& tok : *tokens) {
+                hash = hash_combine(hash_combine(hash, tok.id), hash_bytes(tok.value));
+            }
+        }
+        return hash;
+    }
+
+    template <typename ContextT>
+    void replay_macro_definition(ContextT& ctx, const cache_event& event,
+                                 bool is_predefined = false) {
+        using token_type = typename ContextT::token_type;
+        using position_type = typename ContextT::position_type;
+        const position_type pos(event.value.c_str(), event.line, event.column);
+        const auto to_token = [&](const cached_token& tok) {
+            return token_type(static_cast<boost::wave::token_id>(tok.id), tok.value.c_str(), pos);
+        };
+        std::vector<token_type> parameters;
+        for (const auto& tok : event.parameters) {
+            parameters.push_back(to_token(tok));
+        }
+        typename ContextT::token_sequence_type definition;
+        for (const auto& tok : event.definition) {
+            definition.push_back(to_token(tok));
+        }
+        ctx.add_macro_definition(token_type(boost::wave::T_IDENTIFIER, event.name.c_str(), pos),
+                                 event.is_functionlike, parameters, definition, is_predefined);
+    }
+
+    // Writes text outside of comments the way Wave would hand back its tokens, whose newlines
+    // come without a '\r'.
+    void write_raw_text(std::string_view text, bool has_cr) {
+        if (!has_cr && (state.eol == eol_type::as_is || state.eol == eol_type::lf)) {
+            state.result << text;
+            return;
+        }
+        for (std::size_t newline; (newline = text.find('\n')) != std::string_view::npos;) {
+            auto line = text.substr(0, newline);
+            if (line.ends_with('\r')) {
+                line.remove_suffix(1);
+            }
+            state.result << line;
+            state.write_newline("\n");
+            text.remove_prefix(newline + 1);
+        }
+        state.result << text;
+    }
+
+    // Writes the raw region a placeholder stands for. Returns false if name is no placeholder
+    // of a region passed through.
+    template <typename StringT>
+    bool write_raw_region(StringT const& name) {
+        const auto index =
+            raw_scanner::placeholder_index(std::string_view(name.data(), name.size()));
+        if (!index || *index >= state.raw.regions.size() || !state.raw.regions[*index].passed) {
+            return false;
+        }
+        const auto& region = state.raw.regions[*index];
+        std::size_t written = 0;
+        for (const auto& [begin, end] : region.comments) {
+            write_raw_text(region.text.substr(written, begin - written), region.has_cr);
+            const auto comment = region.text.substr(begin, end - begin);
+            if (!state.remove_comments || is_kept_comment(comment)) {
+                state.result << comment;
+            } else {
+                write_removed_comment(comment);
+            }
+            written = end;
+        }
+        write_raw_text(region.text.substr(written), region.has_cr);
+        return true;
+    }
+
+    // Whether entry would enter and skip the same nested includes now as when it was recorded.
+    // That depends on the include guards and #pragma once files seen before, which the cache
+    // key leaves out, so the entry's own events are played through against ctx.
+    template <typename ContextT>
+    static bool same_nested_includes(ContextT& ctx, const cached_header& entry) {
+        // Files marked or unmarked by the entry itself, with their guard or empty if undefined.
+        boost::unordered_flat_map<std::string_view, std::string_view> guards;
+        const auto skipped = [&](const std::string& file) {
+            const auto it = guards.find(file);
+            return it != guards.end() ? !it->second.empty() : ctx.has_pragma_once(file);
+        };
+        for (const auto& event : entry.events) {
+            switch (event.type) {
+                case cache_event::kind::dependency:
+                    if (skipped(event.name)) {
+                        return false;
+                    }
+                    break;
+                case cache_event::kind::skipped_include:
+                    if (!skipped(event.name)) {
+                        return false;
+                    }
+                    break;
+                case cache_event::kind::include_guard:
+                    guards[event.name] = event.value;
+                    break;
+                case cache_event::kind::undef:
+                    for (auto& [file, guard] : guards) {
+                        if (guard == event.name) {
+                            guard = {};
+                        }
+                    }
+                    break;
+                default:
+                    break;
+            }
+        }
+        return true;
+    }
+
+    // Emits a cached copy of native_name instead of letting Wave lex it. On a miss the file is
+    // queued for recording once Wave opens it.
+    template <typename ContextT>
+    bool replay_cached_header(ContextT& ctx, const std::string& native_name) {
+        auto& recorder = state.recorder;
+        if (ctx.has_pragma_once(native_name)) {
+            // Whoever includes this file now depends on it being left out.
+            recorder.log_event({.type = cache_event::kind::skipped_include, .name = native_name});
+            return false;
+        }
+        std::uint64_t content_hash;
+        if (!recorder.get_content_hash(native_name, content_hash)) {
+            return false;
+        }
+        const auto key = recorder.cache->make_key(native_name, content_hash,
+                                                  recorder.macro_state_hash,
+                                                  ctx.get_iteration_depth());
+        cached_header entry;
+        if (const bool loaded = recorder.cache->load(key, entry);
+            !loaded || !recorder.dependencies_unchanged(entry)) {
+            if (loaded) {
+                recorder.cache->forget(key);
+            }
+            ++recorder.cache->misses;
+            recorder.pending_frame = {.file = native_name,
+                                      .content_hash = content_hash,
+                                      .key = key,
+                                      .recording = true};
+            return false;
+        }
+        if (!same_nested_includes(ctx, entry)) {
+            // The entry stays valid for the includes it was recorded after, so it is kept and
+            // this copy is preprocessed without being recorded.
+            ++recorder.cache->misses;
+            recorder.pending_frame = {.file = native_name, .content_hash = content_hash};
+            return false;
+        }
+        ++recorder.cache->hits;
+
+        recorder.log_event({.type = cache_event::kind::dependency,
+                            .name = native_name,
+                            .content_hash = content_hash});
+        recorder.replaying = true;
+        std::size_t copied = 0;
+        for (const auto& event : entry.events) {
+            switch (event.type) {
+                case cache_event::kind::dependency:
+                    recorder.log_event(event);
+                    break;
+                case cache_event::kind::resolved_path:
+                    state.correct_paths.try_emplace(state.strings.intern(event.name),
+                                                    state.strings.intern(event.value));
+                    state.included_files.insert(event.value);
+                    recorder.log_event(event);
+                    break;
+                case cache_event::kind::define:
+                case cache_event::kind::predefine:
+                    replay_macro_definition(ctx, event);
+                    break;
+                case cache_event::kind::undef:
+                    ctx.remove_macro_definition(event.name);
+                    break;
+                case cache_event::kind::include_guard:
+                    ctx.add_pragma_once_header(event.name, event.value);
+                    break;
+                case cache_event::kind::system_include:
+                    state.result << std::string_view(entry.text).substr(copied,
+                                                                        event.offset - copied);
+                    copied = event.offset;
+                    state.system_includes.emit(event.name);
+                    break;
+                case cache_event::kind::hoist_barrier:
+                    state.system_includes.stop_hoisting();
+                    break;
+                case cache_event::kind::skipped_include:
+                    recorder.log_event(event);
+                    break;
+                case cache_event::kind::missing_include:
+                    state.resolver.note_missing(event.name);
+                    recorder.log_event(event);
+                    break;
+            }
+        }
+        state.result << std::string_view(entry.text).substr(copied);
+        recorder.replaying = false;
+        return true;
+    }
+
+   public:
+    custom_hooks(hook_state& hook_state) : state(hook_state) {}
+
+    template <typename TokenT>
+    static std::string_view name_view(TokenT const& token) {
+        const auto& value = token.get_value();
+        return std::string_view(value.data(), value.size());
+    }
+
+    // Whether a #define is the include guard of the current file, which then opens with
+    // `#ifndef NAME` and an empty `#define NAME`.
+    template <typename TokenT, typename DefinitionT>
+    bool is_include_guard(TokenT const& macro_name, DefinitionT const& definition) const {
+        return state.file_directives == 2 && name_view(macro_name) == state.guard_candidate &&
+               std::all_of(definition.begin(), definition.end(),
+                           [](const auto& tok) { return is_whitespace(tok); });
+    }
+
+    // Writes what stays of a removed comment: the line break a // comment ends with, written as
+    // Wave writes its newlines, or the space a /* */ comment counts as, which keeps the tokens
+    // around it apart.
+    void write_removed_comment(std::string_view comment) {
+        if (comment.starts_with("//") && comment.ends_with('\n')) {
+            state.write_newline("\n");
+        } else if (!std::string_view(" \t\r\n").contains(state.result.last_char())) {
+            state.result << ' ';
+        }
+    }
+
+    template <typename StringT>
+    bool is_kept_comment(StringT const& token_value) const {
+        return state.kept_comments->matches(std::string_view(token_value.data(),
+                                                             token_value.size()));
+    }
+
+    phase_timings* timings() const { return state.timings; }
+    trace_recorder* trace() const { return state.tracing.trace; }
+
+    // Opens an included file, from an include archive or the in-memory sources if there are
+    // any.
+    template <typename StringT>
+    bool open_file(StringT const& file, file_buffer& contents) const {
+        if (const auto* member =
+                state.resolver.find_archived(boost::filesystem::path(file.c_str()))) {
+            contents.assign(member->contents);
+            return true;
+        }
+        if (file_cache::entry entry;
+            state.resolver.loaded_files != nullptr && file != null_device &&
+            state.resolver.loaded_files->get(file.c_str(), entry)) {
+            contents.share(std::move(entry.contents));
+            return true;
+        }
+        if (state.resolver.files == nullptr) {
+            return contents.open(file.c_str());
+        }
+        if (file == null_device) {
+            contents.assign({});  // An include left in the output or replaced by the cache.
+            return true;
+        }
+        const auto* source = state.resolver.files->find(boost::filesystem::path(file.c_str()));
+        if (source == nullptr) {
+            return false;
+        }
+        contents.assign(*source);
+        return true;
+    }
+
+    // Swaps the raw regions of a file about to be lexed for placeholders. Returns false if
+    // Wave is to lex text as it is.
+    bool substitute_raw_regions(std::string_view text, std::string& substituted) {
+        return state.raw.enabled && raw_scanner::substitute(text, state.raw.regions, substituted);
+    }
+
+    const raw_region& get_raw_region(std::size_t index) const { return state.raw.regions[index]; }
+
+    // Whether the directive starting at pos has reached found_directive yet.
+    template <typename PositionT>
+    bool found_directive_at(PositionT const& pos) const {
+        return state.raw.directive_line == pos.get_line() &&
+               state.raw.directive_file == std::string_view(pos.get_file().data(),
+                                                            pos.get_file().size());
+    }
+
+    // Decides, once Wave has got as far as a raw region, whether it would hand the region back
+    // token for token. Text is macro expanded while a directive is being processed. The lexer
+    // passes what it knows of a directive right before the region whose hooks have not run yet:
+    // whether text will be expanded after it, and the macro it defines.
+    template <typename ContextT>
+    bool pass_through_region(ContextT const& ctx, std::size_t index,
+                             std::optional<bool> processing_directive, std::string_view defining) {
+        auto& region = state.raw.regions[index];
+        const auto is_defined = [&](std::string_view name) {
+            return ctx.is_defined_macro(std::string(name));
+        };
+        if (processing_directive.value_or(state.processing_directive)) {
+            region.passed =
+                std::none_of(region.names.begin(), region.names.end(), [&](std::string_view name) {
+                    return name == defining || is_defined(name);
+                });
+            return region.passed;
+        }
+        region.passed = std::none_of(
+            region.spaced_calls.begin(), region.spaced_calls.end(),
+            [&](std::string_view name) { return name == defining || is_defined(name); });
+        return region.passed;
+    }
+
+    // Appends every macro ctx defines, except the ones named in builtin, to events.
+    template <typename ContextT>
+    static void capture_macros(ContextT const& ctx,
+                               const boost::unordered_flat_set<std::string>& builtin,
+                               std::vector<cache_event>& events) {
+        for (auto it = ctx.macro_names_begin(); it != ctx.macro_names_end(); ++it) {
+            std::string name(it->begin(), it->end());
+            if (builtin.contains(name)) {
+                continue;
+            }
+            bool is_functionlike = false;
+            bool is_predefined = false;
+            typename ContextT::position_type pos;
+            std::vector<typename ContextT::token_type> parameters;
+            typename ContextT::token_sequence_type definition;
+            ctx.get_macro_definition(*it, is_functionlike, is_predefined, pos, parameters,
+                                     definition);
+            events.push_back(
+                {.type = is_predefined ? cache_event::kind::predefine : cache_event::kind::define,
+                 .name = std::move(name),
+                 .value = std::string(pos.get_file().begin(), pos.get_file().end()),
+                 .line = static_cast<std::uint32_t>(pos.get_line()),
+                 .column = static_cast<std::uint32_t>(pos.get_column()),
+                 .is_functionlike = is_functionlike,
+                 .parameters = to_cached_tokens(parameters),
+                 .definition = to_cached_tokens(definition)});
+        }
+    }
+
+    // Seeds ctx with the macros and include guards of a prelude snapshot. Nothing is written
+    // out; -d definitions stay predefined, the prelude's own macros can be redefined.
+    template <typename ContextT>
+    void apply_prelude(ContextT& ctx, const std::vector<cache_event>& events) {
+        state.recorder.replaying = true;
+        for (const auto& event : events) {
+            if (event.type == cache_event::kind::define ||
+                event.type == cache_event::kind::predefine) {
+                replay_macro_definition(ctx, event,
+                                        event.type == cache_event::kind::predefine);
+            } else if (event.type == cache_event::kind::include_guard) {
+                ctx.add_pragma_once_header(event.name, event.value);
+            }
+        }
+        state.recorder.replaying = false;
+    }
+
+    template <typename ContextT, typename TokenT, typename ContainerT, typename IteratorT>
+    bool expanding_function_like_macro(ContextT const&, TokenT const& macro_name,
+                                       std::vector<TokenT> const&, ContainerT const&, TokenT const&,
+                                       std::vector<ContainerT> const&, IteratorT const&,
+                                       IteratorT const&) {
+        if (!state.processing_directive) return true;
+        // __VA_OPT__ is reported like a macro, but never as rescanned.
+        if (state.profiler.profile != nullptr && name_view(macro_name) != "__VA_OPT__") {
+            state.profiler.begin_expansion(macro_name);
+        }
+        return false;
+    }
+
+    template <typename ContextT, typename TokenT, typename ContainerT>
+    bool expanding_object_like_macro(ContextT const&, TokenT const& token, ContainerT const&,
+                                     TokenT const&) {
+        const auto macro_name = token.get_value();
+        const bool expand =
+            state.processing_directive || (state.expand_file_macros && macro_name == "__FILE__") ||
+            (state.expand_line_macros && macro_name == "__LINE__") ||
+            (state.expand_include_level_macros && macro_name == "__INCLUDE_LEVEL__");
+        if (expand && state.profiler.profile != nullptr) {
+            state.profiler.begin_expansion(token);
+        }
+        return !expand;
+    }
+
+    template <typename ContextT, typename ContainerT>
+    void rescanned_macro(ContextT const&, ContainerT const& result) {
+        if (state.profiler.profile != nullptr) {
+            state.profiler.end_expansion(result);
+        }
+    }
+
+    // No include paths are registered with Wave, so all it finds are quoted includes next to the
+    // current file. The index rules out misses and leaves only hits to Wave's own probe.
+    // Resolves an include once per directory and name; the file system is taken not to change
+    // during a run. #include_next depends on where the current file was found and is not kept.
+    template <typename ContextT>
+    bool resolve_include(ContextT& ctx, std::string& file_path, std::string& dir_path,
+                         bool is_system, char const* current_file) {
+        if (state.resolver.current_directories.empty()) {
+            // The main file's; those of included files are added as they are opened.
+            state.resolver.current_directories.push_back(
+                state.strings.intern(ctx.get_current_directory().native()));
+        }
+        const auto first_missing = state.resolver.missing.size();
+        if (current_file != nullptr) {
+            const bool found =
+                find_next_to_current_file(ctx, file_path, dir_path, is_system, current_file) ||
+                state.resolver.find_in_include_paths(file_path, dir_path, current_file);
+            state.recorder.log_missing(first_missing, state.resolver.missing.size());
+            return found;
+        }
+        auto& key = state.resolver.resolve_key;
+        key.assign(state.resolver.current_directories.back());
+        key += '\0';
+        key += is_system ? '<' : '"';
+        key += file_path;
+        if (auto it = state.resolver.resolved_includes.find(std::string_view(key));
+            it != state.resolver.resolved_includes.end()) {
+            if (it->second.found) {
+                file_path.assign(it->second.file_path);
+                dir_path.assign(it->second.dir_path);
+            }
+            state.recorder.log_missing(it->second.first_missing, it->second.last_missing);
+            return it->second.found;
+        }
+        const bool found =
+            find_next_to_current_file(ctx, file_path, dir_path, is_system, current_file) ||
+            state.resolver.find_in_include_paths(file_path, dir_path);
+        state.resolver.resolved_includes.emplace(
+            state.strings.intern(key),
+            include_resolver::resolved_include{
+                .found = found,
+                .file_path = found ? state.strings.intern(file_path) : std::string_view(),
+                .dir_path = found ? state.strings.intern(dir_path) : std::string_view(),
+                .first_missing = first_missing,
+                .last_missing = state.resolver.missing.size()});
+        state.recorder.log_missing(first_missing, state.resolver.missing.size());
+        return found;
+    }
+
+    template <typename ContextT>
+    bool find_next_to_current_file(ContextT& ctx, std::string& file_path, std::string& dir_path,
+                                   bool is_system, char const* current_file) {
+        if (state.resolver.files != nullptr) {
+            if (is_system || current_file != nullptr ||
+                !state.resolver.is_file(ctx.get_current_directory(), file_path)) {
+                return false;
+            }
+            file_path =
+                memory_file_system::normalize(file_path, ctx.get_current_directory()).string();
+            dir_path = file_path;
+            return true;
+        }
+        // Quoted includes of archived files are looked up in the archive alone, just as those of
+        // files in a directory are looked up in that directory.
+        boost::filesystem::path relative;
+        if (state.resolver.find_archive_root(ctx.get_current_directory(), relative) != nullptr &&
+            !boost::filesystem::path(file_path).has_root_directory()) {
+            if (is_system || current_file != nullptr) {
+                return false;
+            }
+            const auto candidate =
+                memory_file_system::normalize(file_path, ctx.get_current_directory());
+            if (state.resolver.find_archived(candidate) == nullptr) {
+                state.resolver.note_missing(candidate);
+                return false;
+            }
+            file_path = candidate.string();
+            dir_path = file_path;
+            return true;
+        }
+        if (is_system || current_file != nullptr) {
+            return state.resolver.includes == nullptr &&
+                   ctx.find_include_file(file_path, dir_path, is_system, current_file);
+        }
+        const auto candidate = (ctx.get_current_directory() / file_path).lexically_normal();
+        if ((state.resolver.includes == nullptr ||
+             state.resolver.includes->lookup(ctx.get_current_directory(), file_path) !=
+                 include_index::entry_type::missing) &&
+            ctx.find_include_file(file_path, dir_path, is_system, current_file)) {
+            return true;
+        }
+        state.resolver.note_missing(candidate);
+        return false;
+    }
+
+    template <typename ContextT>
+    bool locate_include_file(ContextT& ctx, std::string& file_path, bool is_system,
+                             char const* current_file, std::string& dir_path,
+                             std::string& native_name) {
+        state.begin_directive();
+        const auto raw_file_path = state.strings.intern(file_path);
+        const double resolve_start =
+            state.tracing.trace != nullptr ? state.tracing.trace->now() : 0;
+        bool found;
+        {
+            phase_timer timer(state.timings, &phase_timings::resolve);
+            found = resolve_include(ctx, file_path, dir_path, is_system, current_file);
+        }
+        if (state.tracing.trace != nullptr) {
+            state.tracing.trace->complete(
+                raw_file_path, "resolve", resolve_start,
+                found ? fmt::format(R"({{"path": "{}"}})", json_escape(file_path))
+                      : R"({"path": null})");
+            state.tracing.next_include = found ? file_path : std::string(raw_file_path);
+            state.tracing.next_include_args = found ? "" : R"({"resolved": false})";
+        }
+        if (found) {
+            native_name = file_path;
+            state.correct_paths.try_emplace(raw_file_path, state.strings.intern(native_name));
+            state.included_files.insert(native_name);
+            if (state.recorder.cache != nullptr) {
+                state.recorder.pending_frame = {};
+                state.recorder.last_recorded.reset();
+                state.recorder.log_event({.type = cache_event::kind::resolved_path,
+                                          .name = std::string(raw_file_path),
+                                          .value = native_name});
+                if (state.tree_shake) {
+                    state.enter_included_output();
+                }
+                const bool replayed = replay_cached_header(ctx, native_name);
+                if (state.tree_shake) {
+                    state.leave_included_output();
+                }
+                if (replayed) {
+                    native_name = null_device;
+                    if (state.tracing.trace != nullptr) {
+                        state.tracing.next_include_args = R"({"cached": true})";
+                    }
+                }
+            }
+            return true;
+        }
+        state.recorder.pending_frame = {};
+        if (is_system) {
+            state.system_includes.emit(raw_file_path);
+        } else {
+            state.result << "#include \"" << raw_file_path << "\"\n";
+        }
+        native_name = null_device;
+        return true;
+    }
+
+    template <typename ContextT>
+    void opened_include_file(ContextT const& ctx, std::string const&, std::string const& absname,
+                             bool) {
+        state.resolver.current_directories.push_back(
+            state.strings.intern(ctx.get_current_directory().native()));
+        state.file_directives = 0;
+        state.guard_candidate.clear();
+        if (state.recorder.cache != nullptr) {
+            state.recorder.open_frame();
+        }
+        if (state.attribution.sizes != nullptr) {
+            state.attribute_output();
+            state.attribution.files.push_back(absname);
+        }
+        if (state.tracing.trace != nullptr) {
+            state.tracing.open_frame(state.tracing.next_include,
+                                     std::move(state.tracing.next_include_args));
+        }
+        if (state.tree_shake) {
+            state.enter_included_output();
+        }
+    }
+
+    template <typename ContextT>
+    void returning_from_include_file(ContextT const&) {
+        state.begin_directive();
+        if (state.resolver.current_directories.size() > 1) {
+            state.resolver.current_directories.pop_back();
+        }
+        state.guard_candidate.clear();
+        if (state.recorder.cache != nullptr) {
+            state.recorder.close_frame();
+        }
+        if (state.tracing.trace != nullptr) {
+            state.tracing.close_frame();
+        }
+        if (state.attribution.sizes != nullptr) {
+            state.attribute_output();
+            state.attribution.files.pop_back();
+        }
+        if (state.tree_shake) {
+            state.leave_included_output();
+        }
+    }
+
+    template <typename ContextT>
+    bool found_include_directive(ContextT const&, std::string const&, bool) {
+        state.processing_directive = false;
+        return false;
+    }
+
+    template <typename ContextT>
+    void detected_include_guard(ContextT const&, std::string const& filename,
+                                std::string const& include_guard) {
+        if (state.recorder.cache != nullptr) {
+            state.recorder.record_include_guard(filename, include_guard);
+        }
+        if (state.include_guards != nullptr) {
+            state.include_guards->emplace_back(filename, include_guard);
+        }
+        state.processing_directive = false;
+    }
+
+    template <typename ContextT, typename TokenT>
+    void detected_pragma_once(ContextT const&, TokenT const&, std::string const& filename) {
+        if (state.recorder.cache != nullptr) {
+            state.recorder.record_include_guard(filename, "__BOOST_WAVE_PRAGMA_ONCE__");
+        }
+        if (state.include_guards != nullptr) {
+            state.include_guards->emplace_back(filename, "__BOOST_WAVE_PRAGMA_ONCE__");
+        }
+        state.processing_directive = false;
+    }
+
+    template <typename ContextT, typename ContainerT>
+    bool interpret_pragma(ContextT const&, ContainerT&, typename ContextT::token_type const& option,
+                          ContainerT const& values, typename ContextT::token_type const&) {
+        state.begin_directive();
+        state.result << "#pragma " << option.get_value() << ' ';
+        log_container(values);
+        state.result << '\n';
+        state.processing_directive = false;
+        return false;
+    }
+
+    template <typename ContextT, typename TokenT, typename ParametersT, typename DefinitionT>
+    void defined_macro(ContextT const&, TokenT const& macro_name, bool is_functionlike,
+                       ParametersT const& parameters, DefinitionT const& definition,
+                       bool is_predefined) {
+        if (state.recorder.cache != nullptr && !is_predefined) {
+            const auto name = macro_name.get_value();
+            const auto& pos = macro_name.get_position();
+            cache_event event{.type = cache_event::kind::define,
+                              .name = std::string(name.begin(), name.end()),
+                              .value = std::string(pos.get_file().begin(), pos.get_file().end()),
+                              .line = static_cast<std::uint32_t>(pos.get_line()),
+                              .column = static_cast<std::uint32_t>(pos.get_column()),
+                              .is_functionlike = is_functionlike,
+                              .parameters = to_cached_tokens(parameters),
+                              .definition = to_cached_tokens(definition)};
+            const auto hash = hash_macro(event);
+            state.recorder.macro_state_hash += hash;
+            state.recorder.macro_hashes[event.name] = hash;
+            state.recorder.log_event(std::move(event));
+        }
+        if (!is_predefined && !state.recorder.replaying) {
+            if (state.system_includes.hoist && configures_system_headers(name_view(macro_name)) &&
+                !is_include_guard(macro_name, definition)) {
+                state.system_includes.stop_hoisting();
+            }
+            state.begin_directive();
+            const auto output_begin = state.result.size();
+            state.result << "#define " << macro_name.get_value();
+            if (is_functionlike) {
+                state.result << '(';
+                for (std::size_t i = 0; i < parameters.size(); ++i) {
+                    state.result << parameters[i].get_value();
+                    if (i + 1 < parameters.size()) {
+                        state.result << (state.minify.enabled ? "," : ", ");
+                    }
+                }
+                state.result << ')';
+            }
+            if (state.minify.enabled) {
+                // A function-like macro's replacement list may follow its ')' directly.
+                const auto body = minified_definition(definition);
+                const auto body_begin = state.result.size();
+                if (!is_functionlike && !body.empty()) {
+                    state.result << ' ';
+                }
+                state.result << body;
+                state.minify.original_bytes += 1 + (parameters.empty() ? 0 : parameters.size() - 1);
+                for (const auto& tok : definition) {
+                    state.minify.original_bytes += tok.get_value().size();
+                }
+                state.minify.written_bytes += state.result.size() - body_begin;
+            } else {
+                state.result << ' ';
+                for (const auto& tok : definition) {
+                    state.result << tok.get_value();
+                }
+            }
+            state.result << '\n';
+            if (state.attribution.sizes != nullptr) {
+                const auto name = macro_name.get_value();
+                auto& entry = state.attribution.macro_sizes[std::string(name.begin(), name.end())];
+                entry.bytes += state.result.size() - output_begin;
+                ++entry.definitions;
+            }
+        }
+        state.processing_directive = false;
+    }
+
+    template <typename ContextT, typename TokenT>
+    void undefined_macro(ContextT const&, TokenT const& macro_name) {
+        if (state.recorder.cache != nullptr) {
+            const auto value = macro_name.get_value();
+            std::string name(value.begin(), value.end());
+            if (auto it = state.recorder.macro_hashes.find(name);
+                it != state.recorder.macro_hashes.end()) {
+                state.recorder.macro_state_hash -= it->second;
+                state.recorder.macro_hashes.erase(it);
+            }
+            state.recorder.log_event({.type = cache_event::kind::undef, .name = std::move(name)});
+        }
+        if (!state.recorder.replaying) {
+            if (state.system_includes.hoist && configures_system_headers(name_view(macro_name))) {
+                state.system_includes.stop_hoisting();
+            }
+            state.begin_directive();
+            state.result << "#undef " << macro_name.get_value() << '\n';
+        }
+        state.processing_directive = false;
+    }
+
+    template <typename ContextT, typename TokenT>
+    bool found_directive(ContextT const&, TokenT const& directive) {
+        state.processing_directive = true;
+        ++state.file_directives;
+        if (state.raw.enabled) {
+            const auto& file = directive.get_position().get_file();
+            state.raw.directive_file.assign(file.begin(), file.end());
+            state.raw.directive_line = directive.get_position().get_line();
+        }
+        return false;
+    }
+
+    template <typename ContextT, typename ContainerT>
+    bool found_unknown_directive(ContextT const&, ContainerT const& line, ContainerT&) {
+        state.begin_directive();
+        log_container(line);
+        state.result << '\n';
+        state.processing_directive = false;
+        return false;
+    }
+
+    template <typename ContextT, typename TokenT, typename ContainerT>
+    bool evaluated_conditional_expression(ContextT const&, TokenT const& directive,
+                                          ContainerT const& expression, bool) {
+        if (state.system_includes.hoist && state.file_directives == 1 &&
+            boost::wave::token_id(directive) == boost::wave::T_PP_IFNDEF) {
+            for (const auto& tok : expression) {
+                if (boost::wave::token_id(tok) == boost::wave::T_IDENTIFIER) {
+                    state.guard_candidate.assign(tok.get_value().begin(), tok.get_value().end());
+                    break;
+                }
+            }
+        }
+        state.processing_directive = false;
+        return false;
+    }
+
+    template <typename ContextT, typename TokenT>
+    TokenT const& generated_token(ContextT const& ctx, TokenT const& token) {
+        if (state.tracing.trace != nullptr) {
+            ++state.tracing.frame_tokens.back();
+        }
+        if (state.raw.tokens_to_skip > 0) {
+            // The comment and newline holding a raw region's line breaks.
+            --state.raw.tokens_to_skip;
+            return token;
+        }
+        if (token.is_valid() && state.minify.enabled) {
+            write_minified_token(ctx, token);
+        } else if (token.is_valid()) {
+            const auto id = boost::wave::token_id(token);
+            if (id == boost::wave::T_IDENTIFIER && !state.raw.regions.empty() &&
+                write_raw_region(token.get_value())) {
+                state.raw.tokens_to_skip = 2;
+            } else if (id == boost::wave::T_NEWLINE) {
+                const auto& value = token.get_value();
+                state.write_newline(std::string_view(value.data(), value.size()));
+            } else if ((id == boost::wave::T_CCOMMENT || id == boost::wave::T_CPPCOMMENT) &&
+                       state.remove_comments) {
+                const auto& value = token.get_value();
+                const std::string_view comment(value.data(), value.size());
+                if (is_kept_comment(comment)) {
+                    state.result << comment;
+                } else {
+                    write_removed_comment(comment);
+                }
+            } else {
+                state.result << token.get_value();
+            }
+        }
+        return token;
+    }
+
+    template <typename ContextT, typename ContainerT>
+    bool found_warning_directive(ContextT const&, ContainerT const& message) {
+        state.begin_directive();
+        state.result << "#warning ";
+        log_container(message);
+        state.result << '\n';
+        state.processing_directive = false;
+        return true;
+    }
+
+    template <typename ContextT, typename ContainerT>
+    bool found_error_directive(ContextT const&, ContainerT const& message) {
+        state.begin_directive();
+        state.result << "#error ";
+        log_container(message);
+        state.result << '\n';
+        state.processing_directive = false;
+        return true;
+    }
+
+    template <typename ContextT, typename ContainerT>
+    void found_line_directive(ContextT const&, ContainerT const& arguments, unsigned int,
+                              std::string const&) {
+        state.begin_directive();
+        state.result << "#line ";
+        log_container(arguments);
+        state.result << '\n';
+        state.processing_directive = false;
+    }
+};
+
+}  // namespace cequip::internal
@@ -0,0 +1,206 @@
+#pragma once
+
+#include "internal/common.hpp"
+#include "internal/report.hpp"
+
+#include <spdlog/spdlog.h>
+
+#include <boost/noncopyable.hpp>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Where the preprocessed text goes.
+namespace cequip::internal {
+
+// Destination of a run's output. File outputs are streamed into a sibling temporary file that
+// only replaces the target once preprocessing succeeded, so a failed run leaves it untouched.
+class output_sink : boost::noncopyable {
+    std::FILE* file = nullptr;
+    std::string target;
+    boost::filesystem::path temp_path;
+    bool failed = false;
+    std::uint64_t hash = hash_bytes({});
+
+    void discard_temp() {
+        if (file != nullptr) {
+            std::fclose(file);
+            file = nullptr;
+        }
+        boost::system::error_code ec;
+        boost::filesystem::remove(temp_path, ec);
+        temp_path.clear();
+    }
+
+   public:
+    phase_timings* timings = nullptr;
+
+    ~output_sink() {
+        if (!temp_path.empty()) {
+            discard_temp();
+        }
+    }
+
+    bool is_open() const { return file != nullptr; }
+
+    // Hash of the bytes written so far, as hash_file() would compute it.
+    std::uint64_t content_hash() const { return hash; }
+
+    bool open(const std::string& output_file_raw) {
+        target = output_file_raw;
+        if (output_file_raw == "stdout") {
+            file = stdout;
+            return true;
+        }
+        if (output_file_raw == "stderr") {
+            file = stderr;
+            return true;
+        }
+        const boost::filesystem::path output_path(output_file_raw);
+        boost::system::error_code ec;
+        temp_path = output_path.parent_path() /
+                    boost::filesystem::unique_path(output_path.filename().string() + ".%%%%%%.tmp",
+                                                   ec);
+        file = ec ? nullptr : std::fopen(temp_path.string().c_str(), "wb");
+        if (file == nullptr) {
+            spdlog::error("Failed to open output file: {}", output_file_raw);
+            temp_path.clear();
+            return false;
+        }
+        return true;
+    }
+
+    void write(std::string_view bytes) {
+        phase_timer timer(timings, &phase_timings::write);
+        if (!failed && std::fwrite(bytes.data(), 1, bytes.size(), file) != bytes.size()) {
+            failed = true;
+        }
+        hash = hash_bytes(bytes, hash);
+    }
+
+    // Whether target already holds exactly what was written to the temporary file.
+    bool target_unchanged() const {
+        boost::system::error_code ec;
+        if (!boost::filesystem::is_regular_file(target, ec)) {
+            return false;
+        }
+        const auto size = boost::filesystem::file_size(target, ec);
+        if (ec || size != boost::filesystem::file_size(temp_path, ec) || ec) {
+            return false;
+        }
+        file_buffer existing;
+        file_buffer written;
+        return existing.open(target.c_str()) && written.open(temp_path.string().c_str()) &&
+               existing.view() == written.view();
+    }
+
+    bool commit() {
+        phase_timer timer(timings, &phase_timings::write);
+        if (temp_path.empty()) {
+            return std::fflush(file) == 0 && !failed;
+        }
+        failed = std::fclose(file) != 0 || failed;
+        file = nullptr;
+        // Leaving an unchanged file alone keeps its modification time, so build systems do not
+        // rebuild whatever depends on it.
+        if (!failed && target_unchanged()) {
+            discard_temp();
+            spdlog::info("Output unchanged: {}", target);
+            return true;
+        }
+        boost::system::error_code ec;
+        if (!failed) {
+            boost::filesystem::rename(temp_path, target, ec);
+        }
+        if (failed || ec) {
+            spdlog::error("Failed to write output file: {}", target);
+            discard_temp();
+            return false;
+        }
+        temp_path.clear();
+
+        const auto output_path = boost::filesystem::canonical(target, ec);
+        if (ec) {
+            spdlog::error("Failed to resolve output file path '{}': {}", target, ec.message());
+            return false;
+        }
+        spdlog::info("Output written to: {}", output_path.string());
+        return true;
+    }
+};
+
+// Append-only output buffer that hands its bytes to the sink whenever a chunk has filled up, so
+// the preprocessed text is never held in memory as a whole. Without a sink it keeps everything.
+class output_buffer : boost::noncopyable {
+    static constexpr std::size_t chunk_size = 64 * 1024;
+
+    output_sink* sink = nullptr;
+    std::string buffer;  // Output bytes from offset base onwards.
+    std::size_t base = 0;
+    std::size_t flushed = 0;
+    std::optional<std::size_t> retained_from;
+    char last = '\n';
+
+   public:
+    output_buffer() = default;
+    explicit output_buffer(output_sink& output) : sink(&output) {}
+
+    void attach(output_sink& output) { sink = &output; }
+
+    output_buffer& operator<<(std::string_view bytes) {
+        if (!bytes.empty()) {
+            last = bytes.back();
+        }
+        buffer.append(bytes);
+        if (sink != nullptr && size() - flushed >= chunk_size) {
+            flush();
+        }
+        return *this;
+    }
+
+    output_buffer& operator<<(char ch) { return *this << std::string_view(&ch, 1); }
+
+    template <typename StringT>
+        requires requires(const StringT& value) {
+            value.data();
+            value.size();
+        }
+    output_buffer& operator<<(const StringT& value) {
+        return *this << std::string_view(value.data(), value.size());
+    }
+
+    // Total number of bytes written so far, including the ones already flushed.
+    std::size_t size() const { return base + buffer.size(); }
+
+    // Last byte written, or a newline while nothing has been.
+    char last_char() const { return last; }
+
+    // Keeps flushed bytes from offset onwards in memory so view() can still reach them.
+    void retain_from(std::optional<std::size_t> offset) { retained_from = offset; }
+
+    std::string_view view(std::size_t offset) const {
+        return std::string_view(buffer).substr(offset - base);
+    }
+
+    void flush() {
+        if (sink == nullptr) {
+            return;
+        }
+        sink->write(view(flushed));
+        flushed = size();
+        const auto keep_from = retained_from ? std::min(*retained_from, flushed) : flushed;
+        buffer.erase(0, keep_from - base);
+        base = keep_from;
+    }
+};
+
+// Flushes what is left of result and completes the output. A buffer without a sink was kept in
+// memory as a whole and is written out here, one at a time for the console.
+bool write_output(const std::string& output_file_raw, output_sink& sink, output_buffer& result);
+
+bool is_console(const std::string& output_file_raw);
+
+}  // namespace cequip::internal
@@ -0,0 +1,98 @@
+#pragma once
+
+#include "cequip.hpp"
+#include "internal/cache.hpp"
+#include "internal/common.hpp"
+#include "internal/file_system.hpp"
+#include "internal/output.hpp"
+#include "internal/report.hpp"
+
+#include <boost/filesystem.hpp>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// One preprocessor run over a file, and what all runs of a process share: the include paths,
+// the prelude, the header cache and the prefetch workers.
+namespace cequip::internal {
+
+// Worker threads that read included files ahead of the runs of a process, shared by all of
+// them. See include_prefetcher.
+struct prefetch_pool {
+    task_pool workers;
+
+    explicit prefetch_pool(std::size_t worker_count) : workers(worker_count) {}
+};
+
+// How long runs waited for included files to be resolved and loaded, summed over all of them.
+// This is the time --prefetch sets out to hide.
+struct include_wait {
+    std::atomic<std::int64_t> resolve_ns = 0;
+    std::atomic<std::int64_t> load_ns = 0;
+
+    void add(const phase_timings& timings) {
+        resolve_ns += timings.resolve.count();
+        load_ns += timings.load.count();
+    }
+};
+
+// Resolved once in main() and shared read-only by every preprocess() call.
+struct shared_setup {
+    include_list_type include_paths;
+    include_index* includes = nullptr;
+    trace_recorder* trace = nullptr;
+    size_report* sizes = nullptr;
+    macro_profile* profile = nullptr;
+    std::vector<std::string> predefined_macros;
+    // Seeds every context in place of predefined_macros when a prelude is in use.
+    const std::vector<cache_event>* prelude = nullptr;
+    header_cache* cache = nullptr;
+    const memory_file_system* files = nullptr;  // In place of the disk, for library calls.
+    file_cache* loaded_files = nullptr;  // Kept between the requests of a server.
+    prefetch_pool* prefetch = nullptr;  // Reads includes ahead of the runs, if set.
+    include_wait* waits = nullptr;  // Collects the runs' waits for included files, if set.
+    // Compiled from the config's --keep-comments-matching once for all runs, if set.
+    const keyword_matcher* kept_comments = nullptr;
+    // Content hashes the caller already knows to be current (watch mode).
+    const boost::unordered_flat_map<std::string, std::uint64_t>* known_content_hashes = nullptr;
+};
+
+bool preprocess(const run_config& config, const boost::filesystem::path& path,
+                const shared_setup& setup, std::string_view contents, output_buffer& result,
+                std::vector<std::string>* included_files = nullptr,
+                phase_timings* timings = nullptr,
+                std::vector<cequip::diagnostic>* diagnostics = nullptr,
+                output_record* record = nullptr);
+
+// A prelude is preprocessed once and only the state it leaves behind is kept: its macros, the
+// include guards it saw and the content hash of every file it read. Its text is discarded.
+bool build_prelude(const run_config& config, const shared_setup& setup,
+                   const boost::filesystem::path& path, std::vector<cache_event>& events);
+
+// The state of a prelude kept on disk between processes.
+namespace prelude_snapshot {
+
+// Everything besides the prelude's files that decides what the snapshot holds.
+std::uint64_t make_key(const run_config& config, const shared_setup& setup,
+                       const boost::filesystem::path& path);
+
+// Fails quietly on a missing, damaged or stale snapshot; the caller rebuilds it then.
+bool load(const std::string& file, std::uint64_t key, const include_list_type& include_paths,
+          std::vector<cache_event>& events);
+
+bool store(const std::string& file, std::uint64_t key, const std::vector<cache_event>& events);
+
+}  // namespace prelude_snapshot
+
+// Points setup at the prelude of config, loaded into events, if it has one. prelude_hash keeps
+// the cached headers of different preludes apart.
+bool setup_prelude(const run_config& config, shared_setup& setup,
+                   std::vector<cache_event>& events, std::uint64_t& prelude_hash);
+
+// Opens the header cache of config and points setup at it, unless it is disabled or its
+// directory cannot be used.
+void setup_header_cache(const run_config& config, shared_setup& setup, std::uint64_t prelude_hash,
+                        std::optional<header_cache>& cache);
+
+}  // namespace cequip::internal
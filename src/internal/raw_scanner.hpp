@@ -0,0 +1,53 @@
+#pragma once
+
+#include <charconv>
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Regions of a file that can be written out as they are instead of being lexed by Wave.
+namespace cequip::internal {
+
+// A run of whole lines without directives, splices or anything else Wave acts on outside of
+// them. Whether Wave would hand such a region back token for token depends on the macros
+// defined once it gets there: text is not macro expanded while no directive is being processed,
+// but Wave still drops the whitespace between the name of any macro and a '(' after it.
+struct raw_region {
+    std::string_view text;
+    std::vector<std::pair<std::size_t, std::size_t>> comments{};  // [begin, end) within text.
+    std::vector<std::string_view> names{};          // Every name in text, once.
+    std::vector<std::string_view> spaced_calls{};  // Names followed by whitespace and a '('.
+    bool has_cr = false;
+    bool passed = false;  // Written verbatim rather than lexed by Wave.
+};
+
+// Finds the raw regions of a file before Wave lexes it and swaps each for a placeholder name
+// followed by a comment holding its newlines, so that line numbers stay right. Whatever the
+// scan is unsure of is left to Wave, the whole file if need be.
+namespace raw_scanner {
+
+inline constexpr std::string_view placeholder = "__cequip_raw_";
+
+inline std::optional<std::size_t> placeholder_index(std::string_view name) {
+    if (!name.starts_with(placeholder)) {
+        return std::nullopt;
+    }
+    name.remove_prefix(placeholder.size());
+    std::size_t index = 0;
+    const auto [end, ec] = std::from_chars(name.data(), name.data() + name.size(), index);
+    if (ec != std::errc() || end != name.data() + name.size()) {
+        return std::nullopt;
+    }
+    return index;
+}
+
+// Appends the raw regions of text to regions and writes text with placeholders in their
+// place to substituted. Returns false, touching neither, if there is nothing to substitute.
+bool substitute(std::string_view text, std::vector<raw_region>& regions, std::string& substituted);
+
+}  // namespace raw_scanner
+
+}  // namespace cequip::internal
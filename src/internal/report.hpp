@@ -0,0 +1,205 @@
+#pragma once
+
+#include "internal/common.hpp"
+
+#include <spdlog/spdlog.h>
+
+#include <boost/noncopyable.hpp>
+#include <boost/unordered/unordered_flat_map.hpp>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// What a run reports about itself besides its output: phase timings, the trace, the size report
+// and the macro profile.
+namespace cequip::internal {
+
+// Wall time a run spent loading files, resolving includes and writing output; what remains of
+// the total went into lexing and macro expansion. Only collected when a caller asks for it.
+struct phase_timings {
+    std::chrono::nanoseconds load{};
+    std::chrono::nanoseconds resolve{};
+    std::chrono::nanoseconds write{};
+};
+
+class phase_timer : boost::noncopyable {
+    std::chrono::nanoseconds* phase = nullptr;
+    std::chrono::steady_clock::time_point start;
+
+   public:
+    phase_timer(phase_timings* timings, std::chrono::nanoseconds phase_timings::*member) {
+        if (timings != nullptr) {
+            phase = &(timings->*member);
+            start = std::chrono::steady_clock::now();
+        }
+    }
+    ~phase_timer() {
+        if (phase != nullptr) {
+            *phase += std::chrono::steady_clock::now() - start;
+        }
+    }
+};
+
+// Escapes text for use inside a JSON string literal.
+std::string json_escape(std::string_view text);
+
+// Collects Chrome trace events (chrome://tracing, Perfetto) for --trace. Every thread that
+// records gets its own track. Nothing calls into it unless tracing was requested.
+class trace_recorder : boost::noncopyable {
+    struct event {
+        char phase;
+        std::string name;
+        const char* category;
+        double timestamp;
+        double duration;
+        std::uint32_t thread;
+        std::string args;
+    };
+
+    const std::chrono::steady_clock::time_point origin = std::chrono::steady_clock::now();
+    std::mutex mutex;
+    std::vector<event> events;
+    std::unordered_map<std::thread::id, std::uint32_t> threads;
+
+    void add(event&& new_event) {
+        std::scoped_lock lock(mutex);
+        new_event.thread =
+            threads.try_emplace(std::this_thread::get_id(), threads.size() + 1).first->second;
+        events.push_back(std::move(new_event));
+    }
+
+   public:
+    // Microseconds since the recorder was created.
+    double now() const {
+        return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - origin)
+            .count();
+    }
+
+    // args is either empty or a JSON object.
+    void begin(std::string_view name, const char* category, std::string args = {}) {
+        add({'B', std::string(name), category, now(), 0, 0, std::move(args)});
+    }
+
+    void end(std::string args = {}) { add({'E', {}, "", now(), 0, 0, std::move(args)}); }
+
+    void complete(std::string_view name, const char* category, double start, std::string args) {
+        add({'X', std::string(name), category, start, now() - start, 0, std::move(args)});
+    }
+
+    void counter(std::string_view name, std::uint64_t value) {
+        add({'C', std::string(name), "", now(), 0, 0, fmt::format(R"({{"value": {}}})", value)});
+    }
+
+    bool write(const std::string& output_file_raw);
+};
+
+class trace_span : boost::noncopyable {
+    trace_recorder* trace;
+
+   public:
+    trace_span(trace_recorder* recorder, std::string_view name, const char* category)
+        : trace(recorder) {
+        if (trace != nullptr) {
+            trace->begin(name, category);
+        }
+    }
+    ~trace_span() {
+        if (trace != nullptr) {
+            trace->end();
+        }
+    }
+};
+
+// Output bytes attributed to the files and re-emitted #defines that produced them, collected
+// during preprocessing for --size-report and merged across all runs of a process.
+class size_report : boost::noncopyable {
+   public:
+    struct macro_entry {
+        std::uint64_t bytes = 0;
+        std::uint64_t definitions = 0;
+    };
+    using file_map = boost::unordered_flat_map<std::string, std::uint64_t>;
+    using macro_map = boost::unordered_flat_map<std::string, macro_entry>;
+
+    void merge(const file_map& files, const macro_map& macros) {
+        std::scoped_lock lock(mutex);
+        for (const auto& [file, bytes] : files) {
+            file_bytes[file] += bytes;
+            total_bytes += bytes;
+        }
+        for (const auto& [name, entry] : macros) {
+            auto& merged = macro_bytes[name];
+            merged.bytes += entry.bytes;
+            merged.definitions += entry.definitions;
+        }
+    }
+
+    void clear() {
+        std::scoped_lock lock(mutex);
+        file_bytes.clear();
+        macro_bytes.clear();
+        total_bytes = 0;
+    }
+
+    // Writes a table, or JSON when the file name ends in ".json".
+    bool write(const std::string& output_file_raw);
+
+   private:
+    std::mutex mutex;
+    file_map file_bytes;
+    macro_map macro_bytes;
+    std::uint64_t total_bytes = 0;
+};
+
+// Macro expansions counted and timed during preprocessing for --profile-macros, merged across
+// all runs of a process. Macros are only expanded in directives: #if and #elif expressions and
+// computed includes.
+class macro_profile : boost::noncopyable {
+   public:
+    struct entry {
+        std::string name;
+        std::string location;  // Of the definition, as file:line.
+        std::uint64_t expansions = 0;
+        std::uint64_t tokens = 0;  // Produced by the expansions, after rescanning.
+        std::chrono::nanoseconds total{};  // Including the macros expanded within.
+        std::chrono::nanoseconds self{};
+    };
+
+    void merge(const std::vector<entry>& run_entries) {
+        std::scoped_lock lock(mutex);
+        for (const auto& run_entry : run_entries) {
+            auto [it, inserted] = entries.try_emplace({run_entry.name, run_entry.location});
+            auto& merged = it->second;
+            if (inserted) {
+                merged.name = run_entry.name;
+                merged.location = run_entry.location;
+            }
+            merged.expansions += run_entry.expansions;
+            merged.tokens += run_entry.tokens;
+            merged.total += run_entry.total;
+            merged.self += run_entry.self;
+        }
+    }
+
+    void clear() {
+        std::scoped_lock lock(mutex);
+        entries.clear();
+    }
+
+    // Writes a table of the top macros by total time.
+    bool write(const std::string& output_file_raw, std::size_t top);
+
+   private:
+    std::mutex mutex;
+    boost::unordered_flat_map<std::pair<std::string, std::string>, entry> entries;
+};
+
+// Macros listed by --profile-macros.
+inline constexpr std::size_t macro_profile_top = 20;
+
+}  // namespace cequip::internal
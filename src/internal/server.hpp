@@ -0,0 +1,11 @@
+#pragma once
+
+#include "internal/common.hpp"
+
+// cequip serve, which preprocesses the requests of build tools.
+namespace cequip::internal {
+
+// Answers the requests read from stdin on stdout, or those of the clients of --socket.
+bool run_serve(const run_config& config);
+
+}  // namespace cequip::internal
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "internal/common.hpp"
+
+#include <boost/noncopyable.hpp>
+#include <boost/wave/language_support.hpp>
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Removal of the definitions of included files that the main file never uses.
+namespace cequip::internal {
+
+// Removes the top-level definitions of included files that nothing reachable from the main file
+// refers to. The output is lexed again and split into top-level declarations; functions,
+// classes, enums, aliases, constexpr variables and macros that only ever define names are
+// candidates, everything else is kept along with all it names. References are plain name
+// matches, so overloads, members and macros sharing a name keep each other alive. Whatever the
+// split cannot make sense of is kept.
+class tree_shaker : boost::noncopyable {
+   public:
+    std::size_t candidates = 0;
+    std::size_t removed = 0;
+
+    explicit tree_shaker(const keyword_matcher& kept) : kept_comments(kept) {}
+
+    // Rewrites text without its unreachable definitions. main_ranges are the byte ranges of
+    // text that came from the main file, in order. Fails without touching shaken if the text
+    // could not be split safely.
+    bool shake(std::string_view output,
+               const std::vector<std::pair<std::size_t, std::size_t>>& main_ranges,
+               boost::wave::language_support language,
+               const std::vector<std::string>& predefined_macros, std::string& shaken,
+               std::string& failure);
+
+   private:
+    const keyword_matcher& kept_comments;
+};
+
+}  // namespace cequip::internal
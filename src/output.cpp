@@ -0,0 +1,30 @@
+#include "internal/output.hpp"
+
+#include <spdlog/spdlog.h>
+
+#include <boost/filesystem.hpp>
+#include <iostream>
+
+namespace cequip::internal {
+
+bool write_output(const std::string& output_file_raw, output_sink& sink, output_buffer& result) {
+    static std::mutex console_mutex;
+    std::unique_lock<std::mutex> lock;
+    if (!sink.is_open()) {
+        if (output_file_raw == "stdout" || output_file_raw == "stderr") {
+            lock = std::unique_lock(console_mutex);
+        }
+        if (!sink.open(output_file_raw)) {
+            return false;
+        }
+        result.attach(sink);
+    }
+    result.flush();
+    return sink.commit();
+}
+
+bool is_console(const std::string& output_file_raw) {
+    return output_file_raw == "stdout" || output_file_raw == "stderr";
+}
+
+}  // namespace cequip::internal
@@ -0,0 +1,829 @@
+#include "internal/preprocess.hpp"
+
+#include "internal/hooks.hpp"
+#include "internal/raw_scanner.hpp"
+#include "internal/tree_shaker.hpp"
+
+#include <spdlog/spdlog.h>
+
+#include <boost/filesystem.hpp>
+#include <boost/wave.hpp>
+#include <boost/wave/cpplexer/cpp_lex_iterator.hpp>
+#include <boost/wave/cpplexer/re2clex/cpp_re2c_lexer.hpp>
+#include <algorithm>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+
+namespace cequip::internal {
+
+namespace {
+
+// Reads the files a run is about to include on worker threads while Wave is still busy with
+// the ones before, so that they come from the page cache (or a server's file cache) once Wave
+// gets to them. Every file read is scanned for #include lines, which are resolved the way
+// locate_include_file() resolves them and read in turn. The scan is a cheap guess: includes in
+// excluded conditionals are read as well, and includes of macros are not read at all.
+class include_prefetcher : boost::noncopyable {
+    struct run_state {
+        include_list_type include_paths;
+        include_index* includes = nullptr;
+        file_cache* loaded_files = nullptr;
+        std::mutex mutex;
+        std::condition_variable idle;
+        bool cancelled = false;
+        std::size_t running = 0;  // Tasks that may still use includes and loaded_files.
+        boost::unordered_flat_set<std::string> visited;
+    };
+
+    prefetch_pool& pool;
+    std::shared_ptr<run_state> state;
+
+    // Header names of the #include lines of text, as (name, is_system).
+    static std::vector<std::pair<std::string, bool>> scan(std::string_view text) {
+        std::vector<std::pair<std::string, bool>> result;
+        const auto skip_blanks = [&](std::size_t pos) {
+            while (pos < text.size() && (text[pos] == ' ' || text[pos] == '\t')) {
+                ++pos;
+            }
+            return pos;
+        };
+        for (auto hash = text.find('#'); hash != std::string_view::npos;
+             hash = text.find('#', hash + 1)) {
+            const auto line_begin = text.rfind('\n', hash) + 1;  // npos + 1 wraps to 0.
+            if (skip_blanks(line_begin) != hash) {
+                continue;
+            }
+            auto pos = skip_blanks(hash + 1);
+            if (text.substr(pos, 7) != "include" ||
+                (pos + 7 < text.size() && is_word_char(text[pos + 7]))) {
+                continue;
+            }
+            pos = skip_blanks(pos + 7);
+            if (pos == text.size() || (text[pos] != '"' && text[pos] != '<')) {
+                continue;
+            }
+            const bool is_system = text[pos] == '<';
+            const auto line = text.substr(pos + 1, text.find('\n', pos) - pos - 1);
+            const auto name_end = line.find(is_system ? '>' : '"');
+            if (name_end != std::string_view::npos && name_end != 0) {
+                result.emplace_back(std::string(line.substr(0, name_end)), is_system);
+            }
+        }
+        return result;
+    }
+
+    static std::optional<boost::filesystem::path> resolve(const run_state& run,
+                                                          const boost::filesystem::path& dir,
+                                                          const std::string& name,
+                                                          bool is_system) {
+        const auto is_file = [&](const boost::filesystem::path& root) {
+            const auto type =
+                run.includes != nullptr ? run.includes->lookup(root, name) : std::nullopt;
+            if (type) {
+                return *type == include_index::entry_type::file;
+            }
+            boost::system::error_code ec;
+            return boost::filesystem::is_regular_file(root / name, ec);
+        };
+        if (!is_system && is_file(dir)) {
+            return (dir / name).lexically_normal();
+        }
+        for (const auto& root : run.include_paths) {
+            if (root.archive != nullptr) {
+                // Archived files are in memory already.
+                if (root.archive->find(root.archive_root, name) != nullptr) {
+                    return std::nullopt;
+                }
+            } else if (is_file(root.dir)) {
+                return (root.dir / name).lexically_normal();
+            }
+        }
+        return std::nullopt;
+    }
+
+    static void read_includes(prefetch_pool& pool, const std::shared_ptr<run_state>& run,
+                              const boost::filesystem::path& dir, std::string_view text) {
+        for (auto& [name, is_system] : scan(text)) {
+            pool.workers.submit([&pool, run, dir, name = std::move(name), is_system] {
+                {
+                    std::scoped_lock lock(run->mutex);
+                    if (run->cancelled) {
+                        return;
+                    }
+                    ++run->running;
+                }
+                read(pool, run, dir, name, is_system);
+                std::scoped_lock lock(run->mutex);
+                if (--run->running == 0) {
+                    run->idle.notify_all();
+                }
+            });
+        }
+    }
+
+    static void read(prefetch_pool& pool, const std::shared_ptr<run_state>& run,
+                     const boost::filesystem::path& dir, const std::string& name,
+                     bool is_system) {
+        const auto path = resolve(*run, dir, name, is_system);
+        if (!path) {
+            return;
+        }
+        {
+            std::scoped_lock lock(run->mutex);
+            if (!run->visited.insert(path->string()).second) {
+                return;
+            }
+        }
+        // Scanning the contents touches every page, which is what brings them into memory.
+        file_cache::entry entry;
+        file_buffer buffer;
+        std::string_view text;
+        if (run->loaded_files != nullptr && run->loaded_files->get(path->string(), entry)) {
+            text = *entry.contents;
+        } else if (run->loaded_files == nullptr && buffer.open(path->string().c_str())) {
+            text = buffer.view();
+        } else {
+            return;
+        }
+        read_includes(pool, run, path->parent_path(), text);
+    }
+
+   public:
+    include_prefetcher(prefetch_pool& prefetch, const shared_setup& setup)
+        : pool(prefetch), state(std::make_shared<run_state>()) {
+        state->include_paths = setup.include_paths;
+        state->includes = setup.includes;
+        state->loaded_files = setup.loaded_files;
+    }
+
+    // Whatever has not been read by the end of the run is not read at all. Reads under way are
+    // waited for, as they use the run's include index and file cache.
+    ~include_prefetcher() {
+        std::unique_lock lock(state->mutex);
+        state->cancelled = true;
+        state->idle.wait(lock, [this] { return state->running == 0; });
+    }
+
+    // Starts on the includes of the main file.
+    void start(const boost::filesystem::path& path, std::string_view text) {
+        {
+            std::scoped_lock lock(state->mutex);
+            state->visited.insert(path.string());
+        }
+        read_includes(pool, state, path.parent_path(), text);
+    }
+};
+
+// Lexer over a file whose raw regions were swapped for placeholders. Whether a region passes
+// through is only known once Wave gets as far as it, so a region that does not is lexed from
+// its original text right there.
+template <typename ContextT>
+class raw_region_lexer
+    : public boost::wave::cpplexer::lex_input_interface<typename ContextT::token_type> {
+    using token_type = typename ContextT::token_type;
+    using lexer_type = boost::wave::cpplexer::lex_input_interface<token_type>;
+    using generator_type = boost::wave::cpplexer::lex_input_interface_generator<token_type>;
+
+   public:
+    raw_region_lexer(ContextT& ctx, std::string_view text,
+                     typename token_type::position_type const& pos,
+                     boost::wave::language_support language)
+        : ctx(ctx),
+          language(language),
+          outer(generator_type::new_lexer(text.data(), text.data() + text.size(), pos, language)) {
+    }
+
+    token_type& get(token_type& result) override {
+        if (inner) {
+            if (boost::wave::token_id(inner->get(result)) != boost::wave::T_EOF) {
+                const auto& value = result.get_value();
+                inner_lines += std::count(value.begin(), value.end(), '\n');
+                return result;
+            }
+            // Drop the comment and newline that follow the placeholder.
+            inner.reset();
+            outer->get(result);
+            outer->get(result);
+        }
+        outer->get(result);
+        const auto id = boost::wave::token_id(result);
+        if (id != boost::wave::T_IDENTIFIER) {
+            track_directive(result);
+            return result;
+        }
+        const auto& value = result.get_value();
+        const auto index =
+            raw_scanner::placeholder_index(std::string_view(value.data(), value.size()));
+        if (!index) {
+            track_directive(result);
+            return result;
+        }
+        if (pass_through(*index, std::exchange(directive, last_directive{}))) {
+            return result;
+        }
+        const auto text = ctx.get_hooks().get_raw_region(*index).text;
+        inner.reset(generator_type::new_lexer(text.data(), text.data() + text.size(),
+                                              result.get_position(), language));
+        inner_lines = 0;
+        return get(result);
+    }
+
+    // A #line right before a region Wave has already looked into lands in the region's lexer.
+    // The outer lexer stands on the placeholder line, as many lines before it as the region's
+    // lexer has consumed, and has to carry on numbered from the #line once the region ends.
+    void set_position(typename token_type::position_type const& pos) override {
+        if (!inner) {
+            outer->set_position(pos);
+            return;
+        }
+        inner->set_position(pos);
+        auto placeholder_pos = pos;
+        placeholder_pos.set_line(pos.get_line() - inner_lines);
+        outer->set_position(placeholder_pos);
+    }
+
+    bool has_include_guards(std::string& guard_name) const override {
+        return outer->has_include_guards(guard_name);
+    }
+
+   private:
+    // The directive on the line before the one being lexed. Wave parses some directives with
+    // a grammar that may look a token past their end, so their hooks may not have run yet when
+    // a placeholder right after them is lexed.
+    struct last_directive {
+        typename token_type::position_type position{};
+        bool unknown = false;
+        std::optional<bool> processing{};  // Whether text is expanded once its hooks run.
+        std::string defines{};
+        bool awaiting_name = false;  // Of the macro defined or the pragma.
+    };
+
+    bool pass_through(std::size_t index, const last_directive& last) {
+        auto& hooks = ctx.get_hooks();
+        if (last.processing.has_value() && !hooks.found_directive_at(last.position)) {
+            if (last.unknown) {
+                return false;
+            }
+            // Redefining a macro the same way does not reach the hook that ends the directive.
+            const bool redefines = !last.defines.empty() && ctx.is_defined_macro(last.defines);
+            return hooks.pass_through_region(ctx, index, *last.processing || redefines,
+                                             last.defines);
+        }
+        return hooks.pass_through_region(ctx, index, std::nullopt, {});
+    }
+
+    void track_directive(const token_type& token) {
+        using namespace boost::wave;
+        const auto id = token_id(token);
+        if (id == T_NEWLINE || id == T_CPPCOMMENT) {
+            at_line_start = true;
+            return;
+        }
+        if (id == T_SPACE || id == T_SPACE2 || id == T_CCOMMENT) {
+            return;
+        }
+        if (!at_line_start) {
+            if (directive.awaiting_name && id == T_IDENTIFIER) {
+                directive.awaiting_name = false;
+                if (directive.processing == false) {
+                    directive.defines.assign(token.get_value().begin(), token.get_value().end());
+                } else if (token.get_value() == "once") {
+                    directive.processing = false;
+                }
+            }
+            return;
+        }
+        at_line_start = false;
+        directive = last_directive{.position = token.get_position()};
+        switch (id) {
+            case T_PP_DEFINE:
+                directive.processing = false;
+                directive.awaiting_name = true;
+                break;
+            case T_PP_IF:
+            case T_PP_ELIF:
+            case T_PP_ERROR:
+            case T_PP_WARNING:
+            case T_PP_LINE:
+                directive.processing = false;
+                break;
+            case T_PP_PRAGMA:
+                // Only #pragma once reaches a hook that ends the directive.
+                directive.processing = true;
+                directive.awaiting_name = true;
+                break;
+            case T_PP_INCLUDE:
+            case T_POUND:
+                directive.processing = true;
+                directive.unknown = true;
+                break;
+            default:
+                // Everything else is either no directive or one Wave handles without lookahead.
+                break;
+        }
+    }
+
+    ContextT& ctx;
+    boost::wave::language_support language;
+    std::unique_ptr<lexer_type> outer;
+    std::unique_ptr<lexer_type> inner;  // Over a raw region not passed through.
+    std::size_t inner_lines = 0;        // Line breaks inner has lexed so far.
+    bool at_line_start = true;
+    last_directive directive;
+};
+
+// Wave's lex_iterator around a lexer of our own, which it takes ownership of.
+template <typename TokenT>
+boost::wave::cpplexer::lex_iterator<TokenT> make_lex_iterator(
+    boost::wave::cpplexer::lex_input_interface<TokenT>* lexer) {
+    using shim_type = boost::wave::cpplexer::impl::lex_iterator_functor_shim<TokenT>;
+    using multi_pass_type = boost::wave::cpplexer::make_multi_pass<shim_type>;
+    boost::wave::cpplexer::lex_iterator<TokenT> result;
+    static_cast<typename multi_pass_type::type&>(result) = typename multi_pass_type::type(
+        typename multi_pass_type::functor_data_type(shim_type(), lexer));
+    return result;
+}
+
+// Iteration context policy that lexes included files from a file_buffer, in place of Wave's
+// load_file_to_string which copies every file into a std::string first.
+struct load_file_to_buffer {
+    template <typename IterContextT>
+    class inner {
+       public:
+        template <typename PositionT>
+        static void init_iterators(IterContextT& iter_ctx, PositionT const& act_pos,
+                                   boost::wave::language_support language) {
+            using iterator_type = typename IterContextT::iterator_type;
+            bool opened;
+            {
+                phase_timer timer(iter_ctx.ctx.get_hooks().timings(), &phase_timings::load);
+                trace_span span(iter_ctx.ctx.get_hooks().trace(), "load_file_contents", "io");
+                opened = iter_ctx.ctx.get_hooks().open_file(iter_ctx.filename, iter_ctx.contents);
+            }
+            if (!opened) {
+                BOOST_WAVE_THROW_CTX(iter_ctx.ctx, boost::wave::preprocess_exception,
+                                     bad_include_file, iter_ctx.filename.c_str(), act_pos);
+                return;
+            }
+            const std::string_view text = iter_ctx.contents.view();
+            if (iter_ctx.ctx.get_hooks().substitute_raw_regions(text, iter_ctx.substituted)) {
+                using lexer_type = raw_region_lexer<std::decay_t<decltype(iter_ctx.ctx)>>;
+                iter_ctx.first = make_lex_iterator(new lexer_type(
+                    iter_ctx.ctx, iter_ctx.substituted, PositionT(iter_ctx.filename), language));
+            } else {
+                iter_ctx.first = iterator_type(text.data(), text.data() + text.size(),
+                                               PositionT(iter_ctx.filename), language);
+            }
+            iter_ctx.last = iterator_type();
+        }
+
+       private:
+        file_buffer contents;
+        std::string substituted;  // contents with its raw regions swapped for placeholders.
+    };
+};
+
+boost::wave::language_support context_language(const run_config& config) {
+    return static_cast<boost::wave::language_support>(
+        config.lang | boost::wave::support_option_preserve_comments |
+        boost::wave::support_option_single_line |
+        boost::wave::support_option_include_guard_detection);
+}
+
+}  // namespace
+
+bool preprocess(const run_config& config, const boost::filesystem::path& path,
+                const shared_setup& setup, std::string_view contents, output_buffer& result,
+                std::vector<std::string>* included_files, phase_timings* timings,
+                std::vector<cequip::diagnostic>* diagnostics, output_record* record) {
+    using lex_iterator_type =
+        boost::wave::cpplexer::lex_iterator<boost::wave::cpplexer::lex_token<>>;
+    using context_type =
+        boost::wave::context<const char*, lex_iterator_type, load_file_to_buffer, custom_hooks>;
+
+    // Tree shaking and hoisting need all of the output before any of it can be written.
+    output_buffer held;
+    hook_state state(config.tree_shake || config.hoist_system_includes ? held : result);
+    // Minified output is rewritten token by token, so nothing can be passed through raw.
+    state.raw.enabled = !config.no_pass_through && !config.minify;
+    const auto path_str = path.string();
+    context_type ctx(contents.data(), contents.data() + contents.size(), path_str.c_str(),
+                     custom_hooks(state));
+    ctx.set_language(context_language(config));
+    state.is_cpp = (config.lang != boost::wave::support_c99);
+    state.remove_comments = config.remove_comments;
+    std::optional<keyword_matcher> kept_comments;
+    if (setup.kept_comments != nullptr) {
+        state.kept_comments = setup.kept_comments;
+    } else if (!config.kept_comment_patterns.empty()) {
+        state.kept_comments = &kept_comments.emplace(config.kept_comment_patterns);
+    }
+    state.minify.enabled = config.minify;
+    state.minify.macros = config.minify_macros;
+    state.tree_shake = config.tree_shake;
+    state.system_includes.hoist = state.system_includes.hoisting = config.hoist_system_includes;
+    state.system_includes.umbrella = config.system_include_umbrella;
+    if (state.system_includes.umbrella.starts_with('<') &&
+        state.system_includes.umbrella.ends_with('>')) {
+        state.system_includes.umbrella.remove_prefix(1);
+        state.system_includes.umbrella.remove_suffix(1);
+    }
+    state.expand_file_macros = config.expand_file_macros;
+    state.expand_line_macros = config.expand_line_macros;
+    state.expand_include_level_macros = config.expand_include_level_macros;
+    state.eol = config.eol;
+    state.resolver.include_paths = &setup.include_paths;
+    state.resolver.includes = setup.includes;
+    state.resolver.files = setup.files;
+    state.resolver.loaded_files = setup.loaded_files;
+    state.timings = timings;
+    state.tracing.trace = setup.trace;
+    state.attribution.sizes = setup.sizes;
+    state.profiler.profile = setup.profile;
+    state.attribution.files.push_back(path_str);
+    state.recorder.cache = setup.cache;
+    state.resolver.track_missing = setup.cache != nullptr;
+    if (setup.known_content_hashes != nullptr) {
+        state.recorder.content_hashes = *setup.known_content_hashes;
+    }
+    if (setup.prelude != nullptr) {
+        ctx.get_hooks().apply_prelude(ctx, *setup.prelude);
+    } else {
+        for (const auto& def : setup.predefined_macros) {
+            ctx.add_macro_definition(def, true);
+        }
+    }
+    if (state.tracing.trace != nullptr) {
+        state.tracing.root = path_str;
+        state.tracing.open_frame(path_str);
+    }
+
+    // Library calls get their diagnostics back and leave the log alone.
+    const auto report = [&](cequip::diagnostic::severity level, std::string_view kind,
+                            std::string message, std::string file = {}, unsigned int line = 0,
+                            unsigned int column = 0) {
+        if (diagnostics != nullptr) {
+            diagnostics->push_back({.level = level,
+                                    .message = std::move(message),
+                                    .file = std::move(file),
+                                    .line = line,
+                                    .column = column});
+        } else if (level == cequip::diagnostic::severity::error) {
+            spdlog::error("{}: {} at {}:{}:{}", kind, message, file, line, column);
+        } else {
+            spdlog::warn("{} for {}: {}", kind, file, message);
+        }
+    };
+    std::optional<include_prefetcher> prefetcher;
+    if (setup.prefetch != nullptr && setup.files == nullptr) {
+        prefetcher.emplace(*setup.prefetch, setup);
+        prefetcher->start(boost::filesystem::absolute(path), contents);
+    }
+    bool success = true;
+    try {
+        for (auto it = ctx.begin(); it != ctx.end(); ++it) {
+        }
+    } catch (const boost::wave::preprocess_exception& e) {
+        report(cequip::diagnostic::severity::error, "Preprocessing error", e.description(),
+               state.get_correct_path(e.file_name()), e.line_no(), e.column_no());
+        success = false;
+    } catch (boost::wave::cpplexer::lexing_exception& e) {
+        report(cequip::diagnostic::severity::error, "Lexing error", e.description(),
+               state.get_correct_path(e.file_name()), e.line_no(), e.column_no());
+        success = false;
+    }
+    // An error leaves the includes it happened in open.
+    while (!state.tracing.frame_tokens.empty()) {
+        state.tracing.close_frame();
+    }
+    if (!success) {
+        return false;
+    }
+    if (state.attribution.sizes != nullptr) {
+        state.attribute_output();
+        state.attribution.sizes->merge(state.attribution.file_sizes, state.attribution.macro_sizes);
+    }
+    if (state.profiler.profile != nullptr) {
+        state.profiler.profile->merge(state.profiler.entries);
+    }
+    if (state.minify.enabled && diagnostics == nullptr) {
+        const auto written = state.result.size();
+        const auto unminified = written - state.minify.written_bytes + state.minify.original_bytes;
+        spdlog::info("Minified {}: {} of {} bytes ({:.1f}%)", path_str, written, unminified,
+                     unminified != 0 ? 100.0 * written / unminified : 100.0);
+    }
+    for (const auto header : state.system_includes.hoisted) {
+        result << system_include_line(header);
+    }
+    if (state.tree_shake) {
+        const auto output = held.view(0);
+        state.main_output.ranges.emplace_back(state.main_output.mark, output.size());
+        // The prelude's macros are known to the shaker by name only, like -d definitions.
+        auto known_macros = setup.predefined_macros;
+        if (setup.prelude != nullptr) {
+            for (const auto& event : *setup.prelude) {
+                if (event.type == cache_event::kind::define) {
+                    known_macros.push_back(event.name);
+                }
+            }
+        }
+        tree_shaker shaker(*state.kept_comments);
+        std::string shaken;
+        std::string failure;
+        if (!shaker.shake(output, state.main_output.ranges, ctx.get_language(), known_macros,
+                          shaken, failure)) {
+            report(cequip::diagnostic::severity::warning, "Tree shaking skipped", failure,
+                   path_str);
+            result << output;
+        } else {
+            if (diagnostics == nullptr) {
+                spdlog::info(
+                    "Tree shaking {}: removed {} of {} definitions, {} of {} bytes ({:.1f}%)",
+                    path_str, shaker.removed, shaker.candidates, output.size() - shaken.size(),
+                    output.size(),
+                    output.empty() ? 0.0
+                                   : 100.0 * (output.size() - shaken.size()) / output.size());
+            }
+            result << shaken;
+        }
+    } else if (state.system_includes.hoist) {
+        result << held.view(0);
+    }
+    if (state.recorder.cache != nullptr) {
+        for (const auto& [key, entry] : state.recorder.recorded_headers) {
+            state.recorder.cache->store(key, entry);
+        }
+    }
+    if (included_files != nullptr) {
+        // Files read from an archive are listed as the archive, once.
+        boost::unordered_flat_set<std::string> dependencies;
+        for (const auto& file : state.included_files) {
+            dependencies.insert(state.resolver.dependency_path(file));
+        }
+        included_files->assign(dependencies.begin(), dependencies.end());
+        if (setup.prelude != nullptr) {
+            for (const auto& event : *setup.prelude) {
+                if (event.type == cache_event::kind::dependency) {
+                    included_files->push_back(state.resolver.dependency_path(event.name));
+                }
+            }
+        }
+    }
+    if (record != nullptr) {
+        // The hashes of the bytes this run preprocessed, whatever the files hold by now. A file
+        // without one leaves the record empty.
+        boost::unordered_flat_map<std::string, std::uint64_t> hashes{
+            {path_str, hash_bytes(contents)}};
+        const auto add_hash = [&](const std::string& file, std::uint64_t hash) {
+            boost::filesystem::path relative;
+            if (const auto* root = state.resolver.find_archive_root(file, relative)) {
+                hashes.try_emplace(root->archive->path().string(), root->archive->content_hash());
+            } else {
+                hashes.try_emplace(file, hash);
+            }
+        };
+        bool complete = true;
+        for (const auto& file : state.included_files) {
+            const auto it = state.recorder.content_hashes.find(file);
+            if (it == state.recorder.content_hashes.end() && !state.resolver.find_archived(file)) {
+                spdlog::debug("No content hash for {}, output record not written", file);
+                complete = false;
+                break;
+            }
+            add_hash(file, it != state.recorder.content_hashes.end() ? it->second : 0);
+        }
+        if (complete && setup.prelude != nullptr) {
+            for (const auto& event : *setup.prelude) {
+                if (event.type == cache_event::kind::dependency) {
+                    add_hash(event.name, event.content_hash);
+                }
+            }
+        }
+        if (complete) {
+            record->files.assign(hashes.begin(), hashes.end());
+            // Every directory an include was looked up in, found there or not, left for the
+            // caller to stamp once the output is written.
+            boost::unordered_flat_set<std::string> directories{
+                state.resolver.lookup_directory(path_str)};
+            for (const auto& file : state.included_files) {
+                directories.insert(state.resolver.lookup_directory(file));
+            }
+            for (const auto missing : state.resolver.missing) {
+                directories.insert(state.resolver.lookup_directory(std::string(missing)));
+            }
+            for (auto& dir : directories) {
+                record->directories.emplace_back(dir, 0);
+            }
+            std::sort(record->directories.begin(), record->directories.end());
+        }
+    }
+    return true;
+}
+
+bool build_prelude(const run_config& config, const shared_setup& setup,
+                   const boost::filesystem::path& path, std::vector<cache_event>& events) {
+    using lex_iterator_type =
+        boost::wave::cpplexer::lex_iterator<boost::wave::cpplexer::lex_token<>>;
+    using context_type =
+        boost::wave::context<const char*, lex_iterator_type, load_file_to_buffer, custom_hooks>;
+
+    file_buffer contents;
+    if (!load_file_contents(path, contents)) {
+        return false;
+    }
+    output_buffer discarded;
+    std::vector<std::pair<std::string, std::string>> include_guards;
+    hook_state state(discarded);
+    const auto path_str = path.string();
+    context_type ctx(contents.begin(), contents.end(), path_str.c_str(), custom_hooks(state));
+    ctx.set_language(context_language(config));
+    state.is_cpp = (config.lang != boost::wave::support_c99);
+    state.remove_comments = true;
+    state.resolver.include_paths = &setup.include_paths;
+    state.resolver.includes = setup.includes;
+    state.resolver.loaded_files = setup.loaded_files;
+    state.include_guards = &include_guards;
+
+    boost::unordered_flat_set<std::string> builtin;
+    for (auto it = ctx.macro_names_begin(); it != ctx.macro_names_end(); ++it) {
+        builtin.emplace(it->begin(), it->end());
+    }
+    for (const auto& def : setup.predefined_macros) {
+        ctx.add_macro_definition(def, true);
+    }
+    try {
+        for (auto it = ctx.begin(); it != ctx.end(); ++it) {
+        }
+    } catch (const boost::wave::preprocess_exception& e) {
+        spdlog::error("Preprocessing error in prelude: {} at {}:{}:{}", e.description(),
+                      state.get_correct_path(e.file_name()), e.line_no(), e.column_no());
+        return false;
+    } catch (boost::wave::cpplexer::lexing_exception& e) {
+        spdlog::error("Lexing error in prelude: {} at {}:{}:{}", e.description(),
+                      state.get_correct_path(e.file_name()), e.line_no(), e.column_no());
+        return false;
+    }
+
+    events.clear();
+    std::vector<std::string> files(state.included_files.begin(), state.included_files.end());
+    std::sort(files.begin(), files.end());
+    files.push_back(path_str);
+    for (const auto& file : files) {
+        std::uint64_t hash;
+        if (!state.recorder.get_content_hash(file, hash)) {
+            spdlog::error("Failed to read prelude dependency: {}", file);
+            return false;
+        }
+        events.push_back({.type = cache_event::kind::dependency, .name = file,
+                          .content_hash = hash});
+    }
+    custom_hooks::capture_macros(ctx, builtin, events);
+    for (auto& [file, guard] : include_guards) {
+        events.push_back({.type = cache_event::kind::include_guard, .name = std::move(file),
+                          .value = std::move(guard)});
+    }
+    return true;
+}
+
+namespace prelude_snapshot {
+
+constexpr std::string_view magic = "CEQUIP-PRELUDE-SNAPSHOT-1";
+
+std::uint64_t make_key(const run_config& config, const shared_setup& setup,
+                       const boost::filesystem::path& path) {
+    auto key = hash_combine(hash_bytes(PROJECT_VERSION), BOOST_VERSION);
+    key = hash_combine(key, config.lang);
+    key = hash_combine(key, hash_bytes(path.string()));
+    for (const auto& def : setup.predefined_macros) {
+        key = hash_combine(key, hash_bytes(def));
+    }
+    for (const auto& root : setup.include_paths) {
+        key = hash_combine(hash_combine(key, hash_bytes(root.dir.string())),
+                           hash_bytes(root.dir_raw));
+    }
+    return key;
+}
+
+bool load(const std::string& file, std::uint64_t key,
+          const include_list_type& include_paths, std::vector<cache_event>& events) {
+    file_buffer contents;
+    if (!contents.open(file.c_str())) {
+        return false;
+    }
+    cache_io::reader in{contents.view()};
+    if (in.string() != magic || in.u64() != key) {
+        return false;
+    }
+    events = in.events();
+    if (!in.ok || !in.data.empty()) {
+        return false;
+    }
+    for (const auto& event : events) {
+        if (event.type != cache_event::kind::dependency) {
+            continue;
+        }
+        std::uint64_t hash;
+        if (const auto* member = find_archived(include_paths, event.name)) {
+            hash = member->content_hash;
+        } else if (!hash_file(event.name, hash)) {
+            return false;
+        }
+        if (hash != event.content_hash) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool store(const std::string& file, std::uint64_t key, const std::vector<cache_event>& events) {
+    std::string data;
+    cache_io::put_string(data, magic);
+    cache_io::put_u64(data, key);
+    cache_io::put_events(data, events);
+    output_sink sink;
+    if (!sink.open(file)) {
+        return false;
+    }
+    output_buffer result(sink);
+    result << data;
+    return write_output(file, sink, result);
+}
+
+}  // namespace prelude_snapshot
+
+namespace {
+
+// Loads the prelude's state from its snapshot when that is still current, otherwise builds it
+// and writes the snapshot for the next run.
+bool load_prelude(const run_config& config, const shared_setup& setup,
+                  std::vector<cache_event>& events) {
+    boost::filesystem::path path;
+    if (!resolve_input_path(config.prelude_file_raw, path)) {
+        return false;
+    }
+    const auto key = prelude_snapshot::make_key(config, setup, path);
+    const auto& snapshot = config.prelude_snapshot_raw;
+    if (!snapshot.empty() && prelude_snapshot::load(snapshot, key, setup.include_paths, events)) {
+        spdlog::info("Prelude snapshot loaded: {} ({} events)", snapshot, events.size());
+        return true;
+    }
+    if (!build_prelude(config, setup, path, events)) {
+        return false;
+    }
+    if (!snapshot.empty()) {
+        if (!prelude_snapshot::store(snapshot, key, events)) {
+            return false;
+        }
+        spdlog::info("Prelude snapshot written: {} ({} events)", snapshot, events.size());
+    }
+    return true;
+}
+
+}  // namespace
+
+bool setup_prelude(const run_config& config, shared_setup& setup,
+                   std::vector<cache_event>& events, std::uint64_t& prelude_hash) {
+    if (config.prelude_file_raw.empty()) {
+        if (!config.prelude_snapshot_raw.empty()) {
+            spdlog::error("--prelude-snapshot requires --prelude");
+            return false;
+        }
+        return true;
+    }
+    if (!load_prelude(config, setup, events)) {
+        return false;
+    }
+    setup.prelude = &events;
+    std::string serialized;
+    cache_io::put_events(serialized, events);
+    prelude_hash = hash_bytes(serialized);
+    return true;
+}
+
+void setup_header_cache(const run_config& config, shared_setup& setup, std::uint64_t prelude_hash,
+                        std::optional<header_cache>& cache) {
+    if (config.no_cache) {
+        return;
+    }
+    const auto cache_dir = config.cache_dir_raw.empty()
+                               ? default_cache_dir()
+                               : boost::filesystem::path(config.cache_dir_raw);
+    boost::system::error_code ec;
+    if (!cache_dir.empty()) {
+        boost::filesystem::create_directories(cache_dir, ec);
+    }
+    if (cache_dir.empty() || ec) {
+        spdlog::warn("Header cache disabled: cannot use cache directory '{}'", cache_dir.string());
+        return;
+    }
+    cache.emplace(cache_dir,
+                  make_cache_config_key(config, setup.include_paths, setup.predefined_macros,
+                                        prelude_hash),
+                  config.cache_size_mb * 1024 * 1024);
+    setup.cache = &*cache;
+}
+
+}  // namespace cequip::internal
@@ -0,0 +1,303 @@
+#include "internal/raw_scanner.hpp"
+
+#include <boost/unordered/unordered_flat_set.hpp>
+#include <algorithm>
+#include <iterator>
+
+namespace cequip::internal {
+
+namespace raw_scanner {
+
+namespace {
+
+constexpr std::size_t npos = std::string_view::npos;
+
+struct line {
+    std::size_t begin = 0;
+    std::size_t end = 0;  // Offset of its '\n'.
+    bool eligible = true;
+    bool has_token = false;
+    bool starts_in_comment = false;
+    bool ends_in_comment = false;
+    bool has_cr = false;
+    bool directive = false;
+};
+
+// Everything one scan finds, and the lexer state carried from one line to the next.
+struct scan {
+    std::string_view text;
+    std::vector<line> lines{};
+    std::vector<std::pair<std::size_t, std::size_t>> comments{};
+    std::vector<std::string_view> names{};  // In order; offsets follow from their data.
+    std::vector<std::string_view> spaced_calls{};
+    bool in_comment = false;
+    std::size_t comment_begin = 0;
+    // The name last seen, as long as only whitespace and comments have followed it.
+    std::size_t name_begin = npos;
+    std::size_t name_end = npos;
+    std::size_t name_line = 0;
+};
+
+// Names Wave acts on in text. The dynamic macros come out doubled when not expanded.
+constexpr std::string_view reserved_names[] = {
+    "_Pragma",       "__VA_ARGS__", "__VA_OPT__", "__FILE__", "__LINE__", "__INCLUDE_LEVEL__",
+    "__has_include", "__has_include_next"};
+
+bool is_name_start(char ch) {
+    return (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') || ch == '_';
+}
+
+bool is_digit(char ch) { return ch >= '0' && ch <= '9'; }
+
+bool is_name_char(char ch) { return is_name_start(ch) || is_digit(ch); }
+
+bool is_punctuator(char ch) {
+    return std::string_view("{}[]()<>;:,.?+-*/%^&|~!=").find(ch) != npos;
+}
+
+bool is_raw_string_prefix(std::string_view name) {
+    return name == "R" || name == "LR" || name == "uR" || name == "UR" || name == "u8R";
+}
+
+// Offset of the quote closing the literal that opens at first, or npos if it does not close
+// on its line. Escapes and characters Wave may reject make the line ineligible.
+std::size_t literal_end(std::string_view text, std::size_t first, std::size_t end, line& current) {
+    const auto quote = text[first];
+    for (auto i = first + 1; i < end; ++i) {
+        const auto ch = text[i];
+        if (ch == quote) {
+            return i;
+        }
+        if (ch == '\\') {
+            if (i + 1 >= end) {
+                return npos;
+            }
+            if (std::string_view("abfnrtv?'\"\\01234567xuU").find(text[i + 1]) == npos) {
+                current.eligible = false;
+            }
+            ++i;
+        } else if (static_cast<unsigned char>(ch) < 0x20 && ch != '\t') {
+            current.eligible = false;
+        }
+    }
+    return npos;
+}
+
+// Lexes the line from current.begin to content_end, which excludes its line break, just far
+// enough to classify it. Returns false if the file has to be left to Wave as a whole.
+bool scan_line(scan& s, line& current, std::size_t content_end, bool spliced) {
+    const auto text = s.text;
+    for (auto i = current.begin; i < content_end;) {
+        if (s.in_comment) {
+            const auto close = text.substr(i, content_end - i).find("*/");
+            if (close == npos) {
+                return !spliced;  // A splice inside a comment could end it early.
+            }
+            s.in_comment = false;
+            i += close + 2;
+            s.comments.emplace_back(s.comment_begin, i);
+            continue;
+        }
+        const auto ch = text[i];
+        const auto next = i + 1 < content_end ? text[i + 1] : '\0';
+        if (ch == ' ' || ch == '\t') {
+            ++i;
+        } else if (ch == '/' && next == '*') {
+            s.in_comment = true;
+            s.comment_begin = i;
+            i += 2;
+        } else if (ch == '/' && next == '/') {
+            if (spliced) {
+                return false;  // The comment goes on to the next line.
+            }
+            s.comments.emplace_back(i, std::min(current.end + 1, text.size()));
+            return true;
+        } else if (ch == '"' || ch == '\'') {
+            current.has_token = true;
+            s.name_end = npos;
+            const auto close = literal_end(text, i, content_end, current);
+            if (close != npos) {
+                i = close + 1;
+                continue;
+            }
+            // Directives such as #error may hold a lone apostrophe.
+            return current.directive &&
+                   text.substr(i, content_end - i).find("/*") == npos;
+        } else if (is_name_start(ch)) {
+            current.has_token = true;
+            auto j = i + 1;
+            while (j < content_end && is_name_char(text[j])) {
+                ++j;
+            }
+            const auto name = text.substr(i, j - i);
+            if (j < content_end && text[j] == '"' && is_raw_string_prefix(name)) {
+                return false;
+            }
+            if (std::find(std::begin(reserved_names), std::end(reserved_names), name) !=
+                std::end(reserved_names)) {
+                current.eligible = false;
+            }
+            s.names.push_back(name);
+            s.name_begin = i;
+            s.name_end = j;
+            s.name_line = s.lines.size();
+            i = j;
+        } else if (is_digit(ch) || (ch == '.' && is_digit(next))) {
+            current.has_token = true;
+            s.name_end = npos;
+            auto j = i + 1;
+            for (; j < content_end; ++j) {
+                const auto c = text[j];
+                if (c == '\'') {
+                    return false;  // A digit separator.
+                }
+                const bool exponent_sign =
+                    (c == '+' || c == '-') &&
+                    std::string_view("eEpP").find(text[j - 1]) != npos;
+                if (!is_name_char(c) && c != '.' && !exponent_sign) {
+                    break;
+                }
+            }
+            i = j;
+        } else {
+            if (!current.has_token && (ch == '#' || (ch == '%' && next == ':'))) {
+                current.directive = true;
+            }
+            current.has_token = true;
+            if (!is_punctuator(ch) || (ch == '%' && next == ':') ||
+                (ch == '?' && next == '?')) {
+                current.eligible = false;
+            } else if (ch == '(' && s.name_end != npos && s.name_end != i) {
+                if (s.name_line == s.lines.size()) {
+                    s.spaced_calls.push_back(
+                        text.substr(s.name_begin, s.name_end - s.name_begin));
+                } else {
+                    // Name and '(' on different lines: Wave joins them.
+                    for (auto k = s.name_line; k < s.lines.size(); ++k) {
+                        s.lines[k].eligible = false;
+                    }
+                    current.eligible = false;
+                }
+            }
+            s.name_end = npos;
+            ++i;
+        }
+    }
+    return true;
+}
+
+}  // namespace
+
+bool substitute(std::string_view text, std::vector<raw_region>& regions, std::string& substituted) {
+    scan s{.text = text};
+    bool spliced = false;
+    for (std::size_t begin = 0; begin < text.size();) {
+        const auto newline = text.find('\n', begin);
+        line current{.begin = begin,
+                     .end = newline != npos ? newline : text.size(),
+                     .eligible = newline != npos && !spliced,
+                     .starts_in_comment = s.in_comment};
+        auto content_end = current.end;
+        if (newline != npos && content_end > begin && text[content_end - 1] == '\r') {
+            --content_end;
+            current.has_cr = true;
+        }
+        // A splice joins the next line to this one.
+        spliced = content_end > begin && text[content_end - 1] == '\\';
+        if (spliced) {
+            current.eligible = false;
+        }
+        if (!scan_line(s, current, content_end, spliced)) {
+            return false;
+        }
+        current.ends_in_comment = s.in_comment;
+        if (current.directive) {
+            s.name_end = npos;  // A directive ends with its line.
+        }
+        s.lines.push_back(current);
+        begin = current.end + 1;
+    }
+
+    std::vector<raw_region> found;
+    std::vector<std::size_t> line_counts;
+    const auto& lines = s.lines;
+    auto comment = s.comments.begin();
+    auto name = s.names.begin();
+    auto spaced_call = s.spaced_calls.begin();
+    boost::unordered_flat_set<std::string_view> unique_names;
+    const auto offset_of = [&](std::string_view part) {
+        return static_cast<std::size_t>(part.data() - text.data());
+    };
+    for (std::size_t first = 0; first < lines.size();) {
+        if (!lines[first].eligible) {
+            ++first;
+            continue;
+        }
+        auto end = first;
+        while (end < lines.size() && lines[end].eligible) {
+            ++end;
+        }
+        const auto next = end;
+        // Regions neither start nor end inside a comment.
+        while (first < end && lines[first].starts_in_comment) {
+            ++first;
+        }
+        while (end > first && lines[end - 1].ends_in_comment) {
+            --end;
+        }
+        // Lines of whitespace and comments stay with Wave, which looks past them for
+        // include guards.
+        if (std::any_of(lines.begin() + first, lines.begin() + end,
+                        [](const line& l) { return l.has_token; })) {
+            const auto begin_offset = lines[first].begin;
+            const auto end_offset = lines[end - 1].end + 1;
+            raw_region region{.text = text.substr(begin_offset, end_offset - begin_offset)};
+            for (; comment != s.comments.end() && comment->first < end_offset; ++comment) {
+                if (comment->first >= begin_offset) {
+                    region.comments.emplace_back(comment->first - begin_offset,
+                                                 comment->second - begin_offset);
+                }
+            }
+            unique_names.clear();
+            for (; name != s.names.end() && offset_of(*name) < end_offset; ++name) {
+                if (offset_of(*name) >= begin_offset && unique_names.insert(*name).second) {
+                    region.names.push_back(*name);
+                }
+            }
+            for (; spaced_call != s.spaced_calls.end() && offset_of(*spaced_call) < end_offset;
+                 ++spaced_call) {
+                if (offset_of(*spaced_call) >= begin_offset) {
+                    region.spaced_calls.push_back(*spaced_call);
+                }
+            }
+            region.has_cr = std::any_of(lines.begin() + first, lines.begin() + end,
+                                        [](const line& l) { return l.has_cr; });
+            found.push_back(std::move(region));
+            line_counts.push_back(end - first);
+        }
+        first = next;
+    }
+    if (found.empty()) {
+        return false;
+    }
+
+    substituted.clear();
+    std::size_t copied = 0;
+    for (std::size_t i = 0; i < found.size(); ++i) {
+        const auto offset = offset_of(found[i].text);
+        substituted.append(text.substr(copied, offset - copied));
+        substituted.append(placeholder);
+        substituted.append(std::to_string(regions.size()));
+        substituted.append("/*");
+        substituted.append(line_counts[i] - 1, '\n');
+        substituted.append("*/\n");
+        copied = offset + found[i].text.size();
+        regions.push_back(std::move(found[i]));
+    }
+    substituted.append(text.substr(copied));
+    return true;
+}
+
+}  // namespace raw_scanner
+
+}  // namespace cequip::internal
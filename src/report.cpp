@@ -0,0 +1,165 @@
+#include "internal/report.hpp"
+
+#include "internal/output.hpp"
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <fstream>
+
+namespace cequip::internal {
+
+std::string json_escape(std::string_view text) {
+    std::string escaped;
+    escaped.reserve(text.size());
+    for (const char ch : text) {
+        switch (ch) {
+            case '"':
+                escaped += "\\\"";
+                break;
+            case '\\':
+                escaped += "\\\\";
+                break;
+            case '\n':
+                escaped += "\\n";
+                break;
+            case '\r':
+                escaped += "\\r";
+                break;
+            case '\t':
+                escaped += "\\t";
+                break;
+            default:
+                if (static_cast<unsigned char>(ch) < 0x20) {
+                    escaped += fmt::format("\\u{:04x}", static_cast<unsigned int>(ch));
+                } else {
+                    escaped += ch;
+                }
+        }
+    }
+    return escaped;
+}
+
+bool trace_recorder::write(const std::string& output_file_raw) {
+    output_sink sink;
+    if (!sink.open(output_file_raw)) {
+        return false;
+    }
+    output_buffer result(sink);
+    std::scoped_lock lock(mutex);
+    result << "{\"traceEvents\": [\n";
+    for (std::size_t i = 0; i < events.size(); ++i) {
+        const auto& e = events[i];
+        result << fmt::format(R"({{"ph": "{}", "pid": 1, "tid": {}, "ts": {:.3f})", e.phase,
+                              e.thread, e.timestamp);
+        if (e.phase != 'E') {
+            result << fmt::format(R"(, "name": "{}", "cat": "{}")", json_escape(e.name),
+                                  e.category);
+        }
+        if (e.phase == 'X') {
+            result << fmt::format(R"(, "dur": {:.3f})", e.duration);
+        }
+        if (!e.args.empty()) {
+            result << ", \"args\": " << e.args;
+        }
+        result << (i + 1 < events.size() ? "},\n" : "}\n");
+    }
+    result << "]}\n";
+    return write_output(output_file_raw, sink, result);
+}
+
+bool size_report::write(const std::string& output_file_raw) {
+    std::scoped_lock lock(mutex);
+    std::vector<std::pair<std::string, std::uint64_t>> files{};
+    for (const auto& [file, bytes] : file_bytes) {
+        if (bytes != 0) {
+            files.emplace_back(file, bytes);
+        }
+    }
+    std::vector<std::pair<std::string, macro_entry>> macros(macro_bytes.begin(),
+                                                            macro_bytes.end());
+    // Largest first, ties by name so the report is stable.
+    std::sort(files.begin(), files.end(), [](const auto& a, const auto& b) {
+        return a.second != b.second ? a.second > b.second : a.first < b.first;
+    });
+    std::sort(macros.begin(), macros.end(), [](const auto& a, const auto& b) {
+        return a.second.bytes != b.second.bytes ? a.second.bytes > b.second.bytes
+                                                : a.first < b.first;
+    });
+    const auto percent = [&](std::uint64_t bytes) {
+        return total_bytes != 0 ? 100.0 * static_cast<double>(bytes) / total_bytes : 0.0;
+    };
+
+    output_sink sink;
+    if (!sink.open(output_file_raw)) {
+        return false;
+    }
+    output_buffer result(sink);
+    if (output_file_raw.ends_with(".json")) {
+        result << fmt::format("{{\n  \"total_bytes\": {},\n  \"files\": [", total_bytes);
+        for (std::size_t i = 0; i < files.size(); ++i) {
+            result << fmt::format(R"({}{{"file": "{}", "bytes": {}}})",
+                                  i == 0 ? "\n    " : ",\n    ", json_escape(files[i].first),
+                                  files[i].second);
+        }
+        result << "\n  ],\n  \"macros\": [";
+        for (std::size_t i = 0; i < macros.size(); ++i) {
+            result << fmt::format(R"({}{{"name": "{}", "bytes": {}, "definitions": {}}})",
+                                  i == 0 ? "\n    " : ",\n    ", json_escape(macros[i].first),
+                                  macros[i].second.bytes, macros[i].second.definitions);
+        }
+        result << "\n  ]\n}\n";
+    } else {
+        result << fmt::format("Output size: {} bytes\n\n{:>12} {:>7}  {}\n", total_bytes, "bytes",
+                              "share", "file");
+        for (const auto& [file, bytes] : files) {
+            result << fmt::format("{:>12} {:>6.2f}%  {}\n", bytes, percent(bytes), file);
+        }
+        result << fmt::format("\n{:>12} {:>7}  {}\n", "bytes", "defines", "macro");
+        for (const auto& [name, entry] : macros) {
+            result << fmt::format("{:>12} {:>7}  {}\n", entry.bytes, entry.definitions, name);
+        }
+    }
+    return write_output(output_file_raw, sink, result);
+}
+
+bool macro_profile::write(const std::string& output_file_raw, std::size_t top) {
+    std::scoped_lock lock(mutex);
+    std::vector<const entry*> sorted;
+    std::uint64_t expansions = 0;
+    std::chrono::nanoseconds self{};
+    for (const auto& [key, macro] : entries) {
+        sorted.push_back(&macro);
+        expansions += macro.expansions;
+        self += macro.self;
+    }
+    // Slowest first, ties by name so the report is stable.
+    std::sort(sorted.begin(), sorted.end(), [](const entry* a, const entry* b) {
+        if (a->total != b->total) {
+            return a->total > b->total;
+        }
+        return std::tie(a->name, a->location) < std::tie(b->name, b->location);
+    });
+    const auto to_ms = [](std::chrono::nanoseconds duration) {
+        return std::chrono::duration<double, std::milli>(duration).count();
+    };
+
+    output_sink sink;
+    if (!sink.open(output_file_raw)) {
+        return false;
+    }
+    output_buffer result(sink);
+    result << fmt::format("Macro expansions: {} of {} macros, {:.3f} ms\n\n{:>12} {:>12} {:>10} "
+                          "{:>10}  {}\n",
+                          expansions, entries.size(), to_ms(self), "total ms", "self ms",
+                          "expansions", "tokens", "macro");
+    for (std::size_t i = 0; i < std::min(top, sorted.size()); ++i) {
+        const auto& macro = *sorted[i];
+        result << fmt::format("{:>12.3f} {:>12.3f} {:>10} {:>10}  {} ({})\n", to_ms(macro.total),
+                              to_ms(macro.self), macro.expansions, macro.tokens, macro.name,
+                              macro.location);
+    }
+    return write_output(output_file_raw, sink, result);
+}
+
+}  // namespace cequip::internal
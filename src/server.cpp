@@ -0,0 +1,779 @@
+#include "internal/server.hpp"
+
+#include "cequip.hpp"
+#include "internal/cache.hpp"
+#include "internal/cli.hpp"
+#include "internal/file_system.hpp"
+#include "internal/output.hpp"
+#include "internal/preprocess.hpp"
+#include "internal/report.hpp"
+
+#include <spdlog/sinks/base_sink.h>
+#include <spdlog/spdlog.h>
+
+#include <boost/filesystem.hpp>
+#include <atomic>
+#include <charconv>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <csignal>
+#endif
+
+namespace cequip::internal {
+
+namespace {
+
+// Just enough JSON to read the requests of `cequip serve`. Every value keeps the text it was
+// parsed from, so a request's id is answered exactly as it was sent.
+struct json_value {
+    enum class kind { null, boolean, number, string, array, object };
+
+    kind type = kind::null;
+    std::string_view text;
+    bool boolean = false;
+    double number = 0;
+    std::string string;
+    std::vector<json_value> items;
+    std::vector<std::pair<std::string, json_value>> members;
+
+    const json_value* find(std::string_view name) const {
+        for (const auto& [key, value] : members) {
+            if (key == name) {
+                return &value;
+            }
+        }
+        return nullptr;
+    }
+};
+
+class json_parser {
+    static constexpr std::size_t max_depth = 64;
+
+    std::string_view text;
+    std::size_t pos = 0;
+    std::size_t depth = 0;
+
+    explicit json_parser(std::string_view input) : text(input) {}
+
+    void skip_space() {
+        while (pos < text.size() &&
+               (text[pos] == ' ' || text[pos] == '\t' || text[pos] == '\n' || text[pos] == '\r')) {
+            ++pos;
+        }
+    }
+
+    bool consume(char ch) {
+        skip_space();
+        if (pos < text.size() && text[pos] == ch) {
+            ++pos;
+            return true;
+        }
+        return false;
+    }
+
+    bool literal(std::string_view word) {
+        if (text.substr(pos, word.size()) != word) {
+            return false;
+        }
+        pos += word.size();
+        return true;
+    }
+
+    bool hex_code(unsigned int& code) {
+        const auto digits = text.substr(pos, 4);
+        const auto [end, ec] = std::from_chars(digits.data(), digits.data() + digits.size(),
+                                               code, 16);
+        if (digits.size() != 4 || ec != std::errc() || end != digits.data() + 4) {
+            return false;
+        }
+        pos += 4;
+        return true;
+    }
+
+    static void append_utf8(std::string& out, unsigned int code) {
+        if (code < 0x80) {
+            out += static_cast<char>(code);
+        } else if (code < 0x800) {
+            out += static_cast<char>(0xc0 | (code >> 6));
+            out += static_cast<char>(0x80 | (code & 0x3f));
+        } else if (code < 0x10000) {
+            out += static_cast<char>(0xe0 | (code >> 12));
+            out += static_cast<char>(0x80 | ((code >> 6) & 0x3f));
+            out += static_cast<char>(0x80 | (code & 0x3f));
+        } else {
+            out += static_cast<char>(0xf0 | (code >> 18));
+            out += static_cast<char>(0x80 | ((code >> 12) & 0x3f));
+            out += static_cast<char>(0x80 | ((code >> 6) & 0x3f));
+            out += static_cast<char>(0x80 | (code & 0x3f));
+        }
+    }
+
+    bool parse_string(std::string& out) {
+        ++pos;  // The opening quote.
+        while (pos < text.size()) {
+            const char ch = text[pos++];
+            if (ch == '"') {
+                return true;
+            }
+            if (static_cast<unsigned char>(ch) < 0x20) {
+                return false;
+            }
+            if (ch != '\\') {
+                out += ch;
+                continue;
+            }
+            if (pos == text.size()) {
+                return false;
+            }
+            switch (text[pos++]) {
+                case '"':
+                    out += '"';
+                    break;
+                case '\\':
+                    out += '\\';
+                    break;
+                case '/':
+                    out += '/';
+                    break;
+                case 'b':
+                    out += '\b';
+                    break;
+                case 'f':
+                    out += '\f';
+                    break;
+                case 'n':
+                    out += '\n';
+                    break;
+                case 'r':
+                    out += '\r';
+                    break;
+                case 't':
+                    out += '\t';
+                    break;
+                case 'u': {
+                    unsigned int code;
+                    if (!hex_code(code)) {
+                        return false;
+                    }
+                    if (code >= 0xd800 && code < 0xdc00) {
+                        unsigned int low;
+                        if (!literal("\\u") || !hex_code(low) || low < 0xdc00 || low >= 0xe000) {
+                            return false;
+                        }
+                        code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+                    }
+                    append_utf8(out, code);
+                    break;
+                }
+                default:
+                    return false;
+            }
+        }
+        return false;
+    }
+
+    bool parse_array(json_value& value) {
+        ++pos;
+        value.type = json_value::kind::array;
+        if (consume(']')) {
+            return true;
+        }
+        do {
+            if (!parse_value(value.items.emplace_back())) {
+                return false;
+            }
+        } while (consume(','));
+        return consume(']');
+    }
+
+    bool parse_object(json_value& value) {
+        ++pos;
+        value.type = json_value::kind::object;
+        if (consume('}')) {
+            return true;
+        }
+        do {
+            auto& [key, member] = value.members.emplace_back();
+            skip_space();
+            if (pos == text.size() || text[pos] != '"' || !parse_string(key) || !consume(':') ||
+                !parse_value(member)) {
+                return false;
+            }
+        } while (consume(','));
+        return consume('}');
+    }
+
+    bool parse_value(json_value& value) {
+        skip_space();
+        if (pos == text.size() || depth == max_depth) {
+            return false;
+        }
+        const auto begin = pos;
+        bool ok;
+        ++depth;
+        switch (text[pos]) {
+            case '{':
+                ok = parse_object(value);
+                break;
+            case '[':
+                ok = parse_array(value);
+                break;
+            case '"':
+                value.type = json_value::kind::string;
+                ok = parse_string(value.string);
+                break;
+            case 't':
+                value.type = json_value::kind::boolean;
+                value.boolean = true;
+                ok = literal("true");
+                break;
+            case 'f':
+                value.type = json_value::kind::boolean;
+                ok = literal("false");
+                break;
+            case 'n':
+                ok = literal("null");
+                break;
+            default: {
+                value.type = json_value::kind::number;
+                const auto [end, ec] =
+                    std::from_chars(text.data() + pos, text.data() + text.size(), value.number);
+                ok = ec == std::errc();
+                pos = end - text.data();
+            }
+        }
+        --depth;
+        value.text = text.substr(begin, pos - begin);
+        return ok;
+    }
+
+   public:
+    static bool parse(std::string_view input, json_value& value) {
+        json_parser parser(input);
+        if (!parser.parse_value(value)) {
+            return false;
+        }
+        parser.skip_space();
+        return parser.pos == input.size();
+    }
+};
+
+// Diagnostics of the request the current thread is serving, if any.
+thread_local std::vector<cequip::diagnostic>* request_diagnostics = nullptr;
+
+// Log sink of `cequip serve`. Warnings and errors logged while serving a request go into its
+// response, and everything else to stderr, as stdout may be carrying responses.
+class request_log_sink : public spdlog::sinks::base_sink<std::mutex> {
+   protected:
+    void sink_it_(const spdlog::details::log_msg& msg) override {
+        if (request_diagnostics != nullptr) {
+            if (msg.level >= spdlog::level::warn) {
+                auto& diagnostic = request_diagnostics->emplace_back();
+                diagnostic.level = msg.level >= spdlog::level::err
+                                       ? cequip::diagnostic::severity::error
+                                       : cequip::diagnostic::severity::warning;
+                diagnostic.message.assign(msg.payload.data(), msg.payload.size());
+            }
+            return;
+        }
+        spdlog::memory_buf_t formatted;
+        formatter_->format(msg, formatted);
+        std::fwrite(formatted.data(), 1, formatted.size(), stderr);
+    }
+
+    void flush_() override { std::fflush(stderr); }
+};
+
+// `cequip serve`: preprocesses requests with the options of a command line each, keeping what
+// does not change between them. Files read, directory listings, resolved include paths,
+// preludes and preprocessed headers all stay in memory, and are used again for as long as the
+// files and directories they came from keep their modification time and size.
+//
+// Messages both ways are framed as the decimal length of the message, a newline and the
+// message, which is a JSON object. A request is
+//   {"id": 1, "args": ["main.cpp", "-i", "include"], "source": "..."}
+// with "source" optional, in place of reading the input file, and an answer
+//   {"id": 1, "success": true, "output": "...", "included_files": [...],
+//    "diagnostics": [{"severity": "error", "message": "...", ...}], "elapsed_ms": 0.8}
+// Requests are answered as they complete, so answers on one stream may come out of order.
+// {"id": 2, "stats": true} is answered with request counts and latency percentiles.
+class request_server : boost::noncopyable {
+    static constexpr std::size_t latency_window = 4096;
+    static constexpr std::size_t max_message = std::size_t(1) << 30;
+    // Header caches are kept for this many configurations, each up to cache_memory bytes.
+    static constexpr std::size_t max_caches = 16;
+    static constexpr std::size_t cache_memory = std::size_t(256) << 20;
+
+    struct prelude_entry {
+        std::shared_ptr<const std::vector<cache_event>> events;
+        std::uint64_t hash = 0;
+    };
+
+    include_index includes;
+    file_cache files;
+
+    std::mutex mutex;
+    boost::unordered_flat_map<std::string, include_list_type> include_lists;
+    boost::unordered_flat_map<std::uint64_t, prelude_entry> preludes;
+    struct cache_entry {
+        std::shared_ptr<header_cache> cache;
+        std::uint64_t last_use = 0;
+    };
+
+    boost::unordered_flat_map<std::uint64_t, cache_entry> caches;
+    std::uint64_t cache_uses = 0;
+    std::uint64_t dropped_cache_hits = 0;  // Of caches no longer kept.
+    std::uint64_t dropped_cache_misses = 0;
+    std::uint64_t requests = 0;
+    std::uint64_t failures = 0;
+    std::vector<double> latencies;  // Of the last latency_window requests, as a ring.
+
+    task_pool pool;  // Last, so requests still running finish before the rest goes.
+
+    bool resolve_includes(const std::vector<std::string>& include_paths_raw,
+                          include_list_type& include_paths) {
+        std::string key;
+        for (const auto& path : include_paths_raw) {
+            key.append(path).push_back('\0');
+        }
+        {
+            std::scoped_lock lock(mutex);
+            if (auto it = include_lists.find(key);
+                it != include_lists.end() &&
+                std::all_of(it->second.begin(), it->second.end(), [](const auto& root) {
+                    return root.archive == nullptr || root.archive->unchanged();
+                })) {
+                include_paths = it->second;
+                return true;
+            }
+        }
+        if (!resolve_include_paths(include_paths_raw, include_paths)) {
+            return false;
+        }
+        std::scoped_lock lock(mutex);
+        include_lists.insert_or_assign(std::move(key), include_paths);
+        return true;
+    }
+
+    bool dependencies_current(const std::vector<cache_event>& events,
+                              const shared_setup& setup) {
+        for (const auto& event : events) {
+            if (event.type != cache_event::kind::dependency) {
+                continue;
+            }
+            file_cache::entry entry;
+            if (const auto* member = find_archived(setup.include_paths, event.name)) {
+                entry.content_hash = member->content_hash;
+            } else if (!files.get(event.name, entry)) {
+                return false;
+            }
+            if (entry.content_hash != event.content_hash) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool load_prelude(const run_config& config, const shared_setup& setup,
+                      prelude_entry& prelude) {
+        boost::filesystem::path path;
+        if (!resolve_input_path(config.prelude_file_raw, path)) {
+            return false;
+        }
+        const auto key = prelude_snapshot::make_key(config, setup, path);
+        {
+            std::scoped_lock lock(mutex);
+            if (auto it = preludes.find(key); it != preludes.end()) {
+                prelude = it->second;
+            }
+        }
+        if (prelude.events != nullptr && dependencies_current(*prelude.events, setup)) {
+            return true;
+        }
+        auto events = std::make_shared<std::vector<cache_event>>();
+        if (!build_prelude(config, setup, path, *events)) {
+            return false;
+        }
+        std::string serialized;
+        cache_io::put_events(serialized, *events);
+        prelude = {std::move(events), hash_bytes(serialized)};
+        std::scoped_lock lock(mutex);
+        preludes.insert_or_assign(key, prelude);
+        return true;
+    }
+
+    // The header cache of a configuration. Past max_caches configurations the least recently
+    // used cache is dropped, once the requests still using it are done.
+    std::shared_ptr<header_cache> cache_for(std::uint64_t config_key) {
+        std::scoped_lock lock(mutex);
+        if (!caches.contains(config_key) && caches.size() >= max_caches) {
+            const auto oldest =
+                std::min_element(caches.begin(), caches.end(), [](const auto& a, const auto& b) {
+                    return a.second.last_use < b.second.last_use;
+                });
+            dropped_cache_hits += oldest->second.cache->hits;
+            dropped_cache_misses += oldest->second.cache->misses;
+            caches.erase(oldest);
+        }
+        auto& entry = caches[config_key];
+        if (entry.cache == nullptr) {
+            entry.cache = std::make_shared<header_cache>(
+                boost::filesystem::path(), config_key,
+                std::numeric_limits<std::uintmax_t>::max(), cache_memory);
+        }
+        entry.last_use = ++cache_uses;
+        return entry.cache;
+    }
+
+    bool run(const json_value& request, output_buffer& output,
+             std::vector<std::string>& included_files,
+             std::vector<cequip::diagnostic>& diagnostics) {
+        const auto* args = request.find("args");
+        if (args == nullptr || args->type != json_value::kind::array) {
+            spdlog::error("Request without \"args\"");
+            return false;
+        }
+        std::vector<std::string> arguments{"cequip"};
+        for (const auto& arg : args->items) {
+            if (arg.type != json_value::kind::string) {
+                spdlog::error("Arguments must be strings");
+                return false;
+            }
+            arguments.push_back(arg.string);
+        }
+        std::vector<char*> argv;
+        for (auto& arg : arguments) {
+            argv.push_back(arg.data());
+        }
+        run_config config;
+        std::string usage_error;
+        if (int exit_code; !parse_cli(static_cast<int>(argv.size()), argv.data(), config,
+                                      exit_code, &usage_error)) {
+            spdlog::error("Invalid arguments: {}", usage_error);
+            return false;
+        }
+        if (config.input_files_raw.size() != 1 || !config.manifest_file_raw.empty() ||
+            config.output_file_raw != "stdout" || !config.output_dir_raw.empty() ||
+            config.watch || !config.trace_file_raw.empty() ||
+            !config.size_report_file_raw.empty() || config.profile_macros ||
+            !config.depfile_raw.empty() || config.depfile_per_output ||
+            !config.prelude_snapshot_raw.empty() || config.version_flag || config.pack ||
+            config.serve) {
+            spdlog::error("A request preprocesses one input and answers with its output; "
+                          "options that write files are not supported");
+            return false;
+        }
+        config.lang = parse_language(config.lang_str);
+        config.eol = parse_eol(config.eol_str);
+        config.minify = config.minify || config.minify_macros;
+
+        shared_setup setup;
+        if (!resolve_includes(config.include_paths_raw, setup.include_paths)) {
+            return false;
+        }
+        setup.predefined_macros = make_predefined_macros(config);
+        setup.includes = &includes;
+        setup.loaded_files = &files;
+
+        boost::filesystem::path path;
+        std::string_view source;
+        file_cache::entry input;
+        if (const auto* text = request.find("source");
+            text != nullptr && text->type == json_value::kind::string) {
+            path = boost::filesystem::absolute(config.input_files_raw.front()).lexically_normal();
+            source = text->string;
+        } else {
+            if (!resolve_input_path(config.input_files_raw.front(), path)) {
+                return false;
+            }
+            if (!files.get(path.string(), input)) {
+                spdlog::error("Failed to open file: {}", path.string());
+                return false;
+            }
+            source = *input.contents;
+        }
+
+        prelude_entry prelude;
+        if (!config.prelude_file_raw.empty()) {
+            if (!load_prelude(config, setup, prelude)) {
+                return false;
+            }
+            setup.prelude = prelude.events.get();
+        }
+        std::shared_ptr<header_cache> cache;
+        if (!config.no_cache) {
+            cache = cache_for(make_cache_config_key(config, setup.include_paths,
+                                                    setup.predefined_macros, prelude.hash));
+            setup.cache = cache.get();
+        }
+        return preprocess(config, path, setup, source, output, &included_files, nullptr,
+                          &diagnostics);
+    }
+
+    void record(double elapsed, bool success) {
+        std::scoped_lock lock(mutex);
+        if (latencies.size() < latency_window) {
+            latencies.push_back(elapsed);
+        } else {
+            latencies[requests % latency_window] = elapsed;
+        }
+        ++requests;
+        failures += success ? 0 : 1;
+    }
+
+    std::string stats(std::string_view id) {
+        std::vector<double> sorted;
+        std::uint64_t total;
+        std::uint64_t failed;
+        std::uint64_t cache_hits;
+        std::uint64_t cache_misses;
+        {
+            std::scoped_lock lock(mutex);
+            sorted = latencies;
+            total = requests;
+            failed = failures;
+            cache_hits = dropped_cache_hits;
+            cache_misses = dropped_cache_misses;
+            for (const auto& [key, entry] : caches) {
+                cache_hits += entry.cache->hits;
+                cache_misses += entry.cache->misses;
+            }
+        }
+        std::sort(sorted.begin(), sorted.end());
+        const auto percentile = [&](double fraction) {
+            if (sorted.empty()) {
+                return 0.0;
+            }
+            const auto rank =
+                static_cast<std::size_t>(fraction * static_cast<double>(sorted.size()));
+            return sorted[std::min(rank, sorted.size() - 1)];
+        };
+        return fmt::format(
+            R"({{"id": {}, "requests": {}, "failed": {}, "latency_ms": {{"p50": {:.3f}, )"
+            R"("p90": {:.3f}, "p99": {:.3f}, "max": {:.3f}}}, "file_cache": {{"hits": {}, )"
+            R"("misses": {}}}, "header_cache": {{"hits": {}, "misses": {}}}, )"
+            R"("directories_listed": {}}})",
+            id, total, failed, percentile(0.5), percentile(0.9), percentile(0.99),
+            sorted.empty() ? 0.0 : sorted.back(), files.hits.load(), files.misses.load(),
+            cache_hits, cache_misses, includes.directories_listed.load());
+    }
+
+    std::string handle(std::string_view message) {
+        const auto start = std::chrono::steady_clock::now();
+        json_value request;
+        if (!json_parser::parse(message, request) || request.type != json_value::kind::object) {
+            return R"({"id": null, "success": false, "diagnostics": [{"severity": "error", )"
+                   R"("message": "Malformed request"}]})";
+        }
+        const auto* id_value = request.find("id");
+        const auto id = id_value != nullptr ? id_value->text : std::string_view("null");
+        if (const auto* flag = request.find("stats"); flag != nullptr && flag->boolean) {
+            return stats(id);
+        }
+
+        includes.revalidate();
+        output_buffer output;
+        std::vector<std::string> included_files;
+        std::vector<cequip::diagnostic> diagnostics;
+        request_diagnostics = &diagnostics;
+        const bool success = run(request, output, included_files, diagnostics);
+        request_diagnostics = nullptr;
+        const std::chrono::duration<double, std::milli> elapsed =
+            std::chrono::steady_clock::now() - start;
+        record(elapsed.count(), success);
+
+        std::sort(included_files.begin(), included_files.end());
+        std::string response = fmt::format(R"({{"id": {}, "success": {}, "output": ")", id,
+                                           success);
+        if (success) {
+            response += json_escape(output.view(0));
+        }
+        response += R"(", "included_files": [)";
+        for (std::size_t i = 0; i < included_files.size(); ++i) {
+            response += fmt::format(R"({}"{}")", i == 0 ? "" : ", ",
+                                    json_escape(included_files[i]));
+        }
+        response += R"(], "diagnostics": [)";
+        for (std::size_t i = 0; i < diagnostics.size(); ++i) {
+            const auto& diagnostic = diagnostics[i];
+            response += fmt::format(
+                R"({}{{"severity": "{}", "message": "{}", "file": "{}", "line": {}, )"
+                R"("column": {}}})",
+                i == 0 ? "" : ", ",
+                diagnostic.level == cequip::diagnostic::severity::error ? "error" : "warning",
+                json_escape(diagnostic.message), json_escape(diagnostic.file), diagnostic.line,
+                diagnostic.column);
+        }
+        response += fmt::format(R"(], "elapsed_ms": {:.3f}}})", elapsed.count());
+        return response;
+    }
+
+    // Reads the next message from in. Fails at its end, or with error set if the length is not
+    // one, after which the stream cannot be read any further.
+    bool read_message(std::FILE* in, std::string& message, std::string& error) {
+        std::size_t size = 0;
+        bool digits = false;
+        int ch;
+        while ((ch = std::fgetc(in)) != EOF) {
+            if (ch == '\n' && digits) {
+                break;
+            }
+            // Blank lines between messages are skipped, which helps when typing them.
+            if (ch == '\r' || (ch == '\n' && !digits)) {
+                continue;
+            }
+            if (!std::isdigit(ch)) {
+                error = "Malformed message length";
+                break;
+            }
+            size = size * 10 + static_cast<std::size_t>(ch - '0');
+            digits = true;
+            if (size > max_message) {
+                error = fmt::format("Message longer than {} bytes", max_message);
+                break;
+            }
+        }
+        if (!error.empty()) {
+            spdlog::error("{}", error);
+            return false;
+        }
+        if (ch == EOF) {
+            return false;
+        }
+        message.resize(size);
+        return std::fread(message.data(), 1, size, in) == size;
+    }
+
+    static void write_message(std::FILE* out, std::string_view message) {
+        fmt::print(out, "{}\n", message.size());
+        std::fwrite(message.data(), 1, message.size(), out);
+        std::fputc('\n', out);
+        std::fflush(out);
+    }
+
+   public:
+    explicit request_server(std::size_t worker_count) : pool(worker_count) {}
+
+    // Answers the requests read from in on out until in ends.
+    void serve_stream(std::FILE* in, std::FILE* out) {
+        std::mutex stream_mutex;
+        std::condition_variable finished;
+        std::size_t pending = 0;
+        std::string message;
+        std::string error;
+        while (read_message(in, message, error)) {
+            {
+                std::scoped_lock lock(stream_mutex);
+                ++pending;
+            }
+            pool.submit([&, message = std::move(message)] {
+                const auto response = handle(message);
+                std::scoped_lock lock(stream_mutex);
+                write_message(out, response);
+                if (--pending == 0) {
+                    finished.notify_all();
+                }
+            });
+            message.clear();
+        }
+        std::unique_lock lock(stream_mutex);
+        if (!error.empty()) {
+            write_message(out, fmt::format(R"({{"id": null, "success": false, "diagnostics": )"
+                                           R"([{{"severity": "error", "message": "{}"}}]}})",
+                                           json_escape(error)));
+        }
+        finished.wait(lock, [&] { return pending == 0; });
+    }
+
+#if defined(__unix__) || defined(__APPLE__)
+    // Serves every connection to the socket as a stream of its own. Runs until it fails.
+    bool serve_socket(const std::string& socket_path) {
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        if (socket_path.size() >= sizeof(address.sun_path)) {
+            spdlog::error("Socket path is too long: {}", socket_path);
+            return false;
+        }
+        std::copy(socket_path.begin(), socket_path.end(), address.sun_path);
+        const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) {
+            spdlog::error("Failed to create socket: {}", std::strerror(errno));
+            return false;
+        }
+        // A socket left behind by an earlier server is replaced.
+        boost::system::error_code ec;
+        if (boost::filesystem::status(socket_path, ec).type() == boost::filesystem::socket_file) {
+            boost::filesystem::remove(socket_path, ec);
+        }
+        if (bind(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0 ||
+            listen(fd, SOMAXCONN) != 0) {
+            spdlog::error("Failed to listen on {}: {}", socket_path, std::strerror(errno));
+            close(fd);
+            return false;
+        }
+        spdlog::info("Listening on {}", socket_path);
+        while (true) {
+            const int connection = accept(fd, nullptr, nullptr);
+            if (connection < 0) {
+                if (errno == EINTR || errno == ECONNABORTED) {
+                    continue;
+                }
+                spdlog::error("Failed to accept a connection: {}", std::strerror(errno));
+                close(fd);
+                return false;
+            }
+            std::thread([this, connection] {
+                std::FILE* in = fdopen(connection, "rb");
+                std::FILE* out = in != nullptr ? fdopen(dup(connection), "wb") : nullptr;
+                if (out != nullptr) {
+                    serve_stream(in, out);
+                    std::fclose(out);
+                }
+                if (in != nullptr) {
+                    std::fclose(in);
+                } else {
+                    close(connection);
+                }
+            }).detach();
+        }
+    }
+#endif
+};
+
+}  // namespace
+
+bool run_serve(const run_config& config) {
+    spdlog::set_default_logger(
+        std::make_shared<spdlog::logger>("cequip", std::make_shared<request_log_sink>()));
+    configure_logging(config);
+#if defined(__unix__) || defined(__APPLE__)
+    // A client that hangs up before its answer must not take the server down.
+    std::signal(SIGPIPE, SIG_IGN);
+#endif
+
+    request_server server(config.jobs != 0 ? config.jobs
+                                           : std::max(1u, std::thread::hardware_concurrency()));
+    if (config.socket_path_raw.empty()) {
+        server.serve_stream(stdin, stdout);
+        return true;
+    }
+#if defined(__unix__) || defined(__APPLE__)
+    return server.serve_socket(config.socket_path_raw);
+#else
+    spdlog::error("--socket is not supported on this platform");
+    return false;
+#endif
+}
+
+}  // namespace cequip::internal
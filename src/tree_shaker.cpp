@@ -0,0 +1,765 @@
+#include "internal/tree_shaker.hpp"
+
+#include <spdlog/spdlog.h>
+
+#include <boost/unordered/unordered_flat_map.hpp>
+#include <boost/unordered/unordered_flat_set.hpp>
+#include <boost/wave.hpp>
+#include <boost/wave/cpplexer/cpp_lex_iterator.hpp>
+#include <boost/wave/cpplexer/re2clex/cpp_re2c_lexer.hpp>
+#include <algorithm>
+#include <optional>
+
+namespace cequip::internal {
+
+namespace {
+
+// One tree_shaker::shake() call, with everything it learns about the text.
+class shaking_pass : boost::noncopyable {
+    struct token {
+        boost::wave::token_id id;
+        std::string_view value;
+        std::size_t offset = 0;
+        bool in_main = false;
+    };
+
+    struct definition {
+        std::size_t first = 0;  // Token range, inclusive.
+        std::size_t last = 0;
+        std::vector<std::string_view> names{};
+        // Macros whose ## operands are not all parameters can form names that appear nowhere
+        // in the text; only names containing one of the fixed operands can come from them.
+        std::vector<std::string_view> paste_fragments{};
+        bool pastes_any_name = false;
+        bool kept = false;
+    };
+
+    static constexpr std::size_t none = static_cast<std::size_t>(-1);
+
+    // Names the language or the standard library use without the source spelling them out:
+    // range-for calls begin and end, structured bindings get, and algorithms swap via ADL.
+    static constexpr std::string_view implicit_names[] = {"main", "begin", "end", "get", "swap"};
+
+    std::string_view text;
+    std::vector<token> tokens;
+    std::vector<definition> definitions;
+    std::vector<std::size_t> owners;  // Candidate definition of each token, or none.
+    boost::unordered_flat_set<std::string_view> macro_names;
+    boost::unordered_flat_map<std::string_view, std::vector<std::size_t>> defined_by;
+    boost::unordered_flat_set<std::string_view> reached;
+    std::vector<std::string_view> pending;
+    bool pastes_any_name = false;
+    const keyword_matcher& kept_comments;
+
+    static bool is_blank(boost::wave::token_id id) {
+        return IS_CATEGORY(id, boost::wave::WhiteSpaceTokenType) ||
+               IS_CATEGORY(id, boost::wave::EOLTokenType) ||
+               IS_CATEGORY(id, boost::wave::EOFTokenType);
+    }
+
+    static bool is_name(boost::wave::token_id id) {
+        return IS_CATEGORY(id, boost::wave::IdentifierTokenType) ||
+               IS_CATEGORY(id, boost::wave::KeywordTokenType);
+    }
+
+    static bool is_directive(boost::wave::token_id id) {
+        return IS_CATEGORY(id, boost::wave::PPTokenType) || BASE_TOKEN(id) == boost::wave::T_POUND;
+    }
+
+    static int nesting(boost::wave::token_id id) {
+        switch (BASE_TOKEN(id)) {
+            case boost::wave::T_LEFTPAREN:
+            case boost::wave::T_LEFTBRACKET:
+            case boost::wave::T_LEFTBRACE:
+                return 1;
+            case boost::wave::T_RIGHTPAREN:
+            case boost::wave::T_RIGHTBRACKET:
+            case boost::wave::T_RIGHTBRACE:
+                return -1;
+            default:
+                return 0;
+        }
+    }
+
+    boost::wave::token_id id(std::size_t i) const { return BASE_TOKEN(tokens[i].id); }
+
+    std::size_t next_significant(std::size_t i, std::size_t last) const {
+        while (i <= last && is_blank(tokens[i].id)) {
+            ++i;
+        }
+        return i;
+    }
+
+    // Last token of the directive starting at i: its newline, or a // comment, which takes the
+    // newline with it.
+    std::size_t directive_end(std::size_t i) const {
+        while (i + 1 < tokens.size() && id(i) != boost::wave::T_NEWLINE &&
+               id(i) != boost::wave::T_CPPCOMMENT) {
+            ++i;
+        }
+        return i;
+    }
+
+    void add_definition(definition def) {
+        const auto index = definitions.size();
+        for (auto i = def.first; i <= def.last; ++i) {
+            owners[i] = index;
+        }
+        for (const auto name : def.names) {
+            defined_by[name].push_back(index);
+        }
+        definitions.push_back(std::move(def));
+    }
+
+    bool in_main(std::size_t first, std::size_t last) const {
+        for (auto i = first; i <= last; ++i) {
+            if (tokens[i].in_main) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void add_directive(std::size_t first, std::size_t last) {
+        const auto directive = id(first);
+        if ((directive != boost::wave::T_PP_DEFINE && directive != boost::wave::T_PP_UNDEF) ||
+            in_main(first, last)) {
+            return;
+        }
+        const auto name = next_significant(first + 1, last);
+        if (name > last || !is_name(tokens[name].id)) {
+            return;
+        }
+        definition def{.first = first, .last = last, .names = {tokens[name].value}};
+        if (directive == boost::wave::T_PP_DEFINE) {
+            boost::unordered_flat_set<std::string_view> parameters{"__VA_ARGS__"};
+            auto body = name + 1;
+            if (body <= last && id(body) == boost::wave::T_LEFTPAREN) {
+                for (; body <= last && id(body) != boost::wave::T_RIGHTPAREN; ++body) {
+                    if (is_name(tokens[body].id)) {
+                        parameters.insert(tokens[body].value);
+                    }
+                }
+                ++body;
+            }
+            std::vector<std::size_t> significant;
+            for (auto i = body; i <= last; ++i) {
+                if (!is_blank(tokens[i].id)) {
+                    significant.push_back(i);
+                }
+            }
+            for (std::size_t k = 1; k + 1 < significant.size(); ++k) {
+                if (id(significant[k]) != boost::wave::T_POUND_POUND) {
+                    continue;
+                }
+                const auto lhs = tokens[significant[k - 1]].value;
+                const auto rhs = tokens[significant[k + 1]].value;
+                if (parameters.contains(lhs) && parameters.contains(rhs)) {
+                    def.pastes_any_name = true;
+                }
+                for (const auto operand : {lhs, rhs}) {
+                    if (!parameters.contains(operand)) {
+                        def.paste_fragments.push_back(operand);
+                    }
+                }
+            }
+        }
+        add_definition(std::move(def));
+    }
+
+    // Index of the '{' opening a namespace or linkage block that starts at i.
+    std::optional<std::size_t> scope_opening(std::size_t i) const {
+        const auto last = tokens.size() - 1;
+        if (tokens[i].value == "extern") {
+            const auto literal = next_significant(i + 1, last);
+            if (literal > last ||
+                !IS_CATEGORY(tokens[literal].id, boost::wave::StringLiteralTokenType)) {
+                return std::nullopt;
+            }
+            const auto brace = next_significant(literal + 1, last);
+            return brace <= last && id(brace) == boost::wave::T_LEFTBRACE ? std::optional(brace)
+                                                                          : std::nullopt;
+        }
+        if (tokens[i].value == "inline") {
+            i = next_significant(i + 1, last);
+        }
+        if (i > last || tokens[i].value != "namespace") {
+            return std::nullopt;
+        }
+        for (i = next_significant(i + 1, last); i <= last; i = next_significant(i + 1, last)) {
+            if (id(i) == boost::wave::T_LEFTBRACE) {
+                return i;
+            }
+            if (!is_name(tokens[i].id) && id(i) != boost::wave::T_COLON_COLON) {
+                return std::nullopt;
+            }
+        }
+        return std::nullopt;
+    }
+
+    // Last token of the declaration starting at first, or none if its brackets do not balance.
+    // Directives inside are skipped and reported.
+    std::size_t declaration_end(std::size_t first, bool& has_directive) const {
+        int depth = 0;
+        std::vector<std::size_t> significant;
+        for (auto i = first; i < tokens.size(); ++i) {
+            const auto token_id = id(i);
+            if (is_directive(tokens[i].id)) {
+                has_directive = true;
+                i = directive_end(i);
+                continue;
+            }
+            if (is_blank(token_id)) {
+                continue;
+            }
+            if (depth == 0 && token_id == boost::wave::T_SEMICOLON) {
+                return i;
+            }
+            if (depth == 0 && token_id == boost::wave::T_RIGHTBRACE) {
+                // The end of an enclosing namespace; the declaration ended without a ';'.
+                return significant.empty() ? none : significant.back();
+            }
+            significant.push_back(i);
+            depth += nesting(token_id);
+            if (depth == 0 && token_id == boost::wave::T_RIGHTBRACE) {
+                const auto next = next_significant(i + 1, tokens.size() - 1);
+                if (next < tokens.size() && id(next) == boost::wave::T_SEMICOLON) {
+                    return next;
+                }
+                if (!continues_after_body(significant)) {
+                    return i;
+                }
+            }
+        }
+        return depth == 0 && !significant.empty() ? significant.back() : none;
+    }
+
+    // Whether a declaration goes on after the body its significant tokens end with: class
+    // bodies and initializers are followed by declarators or a ';', function bodies are not.
+    bool continues_after_body(const std::vector<std::size_t>& significant) const {
+        std::size_t k = 0;
+        while (k + 1 < significant.size() && tokens[significant[k]].value == "template" &&
+               id(significant[k + 1]) == boost::wave::T_LESS) {
+            k = matching_angle(significant, k + 1);
+            if (k == none) {
+                return true;
+            }
+            ++k;
+        }
+        const auto keyword = tokens[significant[k]].value;
+        if (keyword == "class" || keyword == "struct" || keyword == "union" ||
+            keyword == "enum" || keyword == "typedef") {
+            return true;
+        }
+        for (; k < significant.size(); ++k) {
+            if (id(significant[k]) == boost::wave::T_ASSIGN) {
+                return true;
+            }
+            if (nesting(id(significant[k])) > 0) {
+                k = matching(significant, k);
+                if (k == none) {
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    // Index in significant of the bracket closing the one at k.
+    std::size_t matching(const std::vector<std::size_t>& significant, std::size_t k) const {
+        int depth = 0;
+        for (; k < significant.size(); ++k) {
+            depth += nesting(id(significant[k]));
+            if (depth == 0) {
+                return k;
+            }
+        }
+        return none;
+    }
+
+    // Index in significant of the '>' closing the template parameter list opened at k.
+    std::size_t matching_angle(const std::vector<std::size_t>& significant, std::size_t k) const {
+        int angles = 0;
+        for (; k < significant.size(); ++k) {
+            const auto token_id = id(significant[k]);
+            if (nesting(token_id) > 0) {
+                k = matching(significant, k);
+                if (k == none) {
+                    return none;
+                }
+            } else if (token_id == boost::wave::T_LESS) {
+                ++angles;
+            } else if (token_id == boost::wave::T_GREATER) {
+                --angles;
+            } else if (token_id == boost::wave::T_SHIFTRIGHT) {
+                angles -= 2;
+            }
+            if (angles <= 0) {
+                return angles == 0 ? k : none;
+            }
+        }
+        return none;
+    }
+
+    // Names a top-level declaration defines if it is a candidate for removal, else nothing.
+    std::vector<std::string_view> declared_names(
+        const std::vector<std::size_t>& significant) const {
+        const auto value = [&](std::size_t k) {
+            return k < significant.size() ? tokens[significant[k]].value : std::string_view();
+        };
+        const auto is_identifier = [&](std::size_t k) {
+            return k < significant.size() && id(significant[k]) == boost::wave::T_IDENTIFIER;
+        };
+        const auto token_id = [&](std::size_t k) {
+            return k < significant.size() ? id(significant[k]) : boost::wave::T_EOF;
+        };
+        const auto skip_attributes = [&](std::size_t k) {
+            while (k < significant.size()) {
+                if (token_id(k) == boost::wave::T_LEFTBRACKET &&
+                    token_id(k + 1) == boost::wave::T_LEFTBRACKET) {
+                    k = matching(significant, k);
+                } else if (value(k) == "alignas" && token_id(k + 1) == boost::wave::T_LEFTPAREN) {
+                    k = matching(significant, k + 1);
+                } else {
+                    return k;
+                }
+                if (k == none) {
+                    return k;
+                }
+                ++k;
+            }
+            return k;
+        };
+        // Index of the first bracket of kind open at nesting depth 0 from k, or the end.
+        const auto find_open = [&](std::size_t k, boost::wave::token_id open) {
+            for (; k < significant.size(); ++k) {
+                if (token_id(k) == open) {
+                    return k;
+                }
+                if (nesting(token_id(k)) > 0) {
+                    k = matching(significant, k);
+                    if (k == none) {
+                        return significant.size();
+                    }
+                }
+            }
+            return significant.size();
+        };
+
+        const auto end = significant.size();
+        std::size_t k = 0;
+        while (value(k) == "template") {
+            if (token_id(k + 1) != boost::wave::T_LESS) {
+                return {};  // An explicit instantiation.
+            }
+            k = matching_angle(significant, k + 1);
+            if (k == none) {
+                return {};
+            }
+            ++k;
+        }
+        k = skip_attributes(k);
+        if (k == none || k >= end) {
+            return {};
+        }
+        const auto keyword = value(k);
+        for (auto i = k; i < end; ++i) {
+            static constexpr std::string_view kept_keywords[] = {
+                "operator", "extern", "asm", "__asm", "__asm__", "__attribute__", "__declspec",
+                "friend", "try", "static_assert", "concept", "export", "module", "import"};
+            if (std::find(std::begin(kept_keywords), std::end(kept_keywords), value(i)) !=
+                std::end(kept_keywords)) {
+                return {};
+            }
+        }
+
+        if (keyword == "typedef") {
+            // typedef-names are the identifiers closing a declarator.
+            std::vector<std::string_view> names;
+            for (auto i = k + 1; i < end; ++i) {
+                if (token_id(i) == boost::wave::T_LEFTBRACE) {
+                    i = matching(significant, i);
+                    if (i == none) {
+                        return {};
+                    }
+                    continue;
+                }
+                const auto before = value(i - 1);
+                const auto next = token_id(i + 1);
+                if (is_identifier(i) && (before == "struct" || before == "class" ||
+                                         before == "union" || before == "enum")) {
+                    names.push_back(value(i));
+                } else if (is_identifier(i) &&
+                    (next == boost::wave::T_SEMICOLON || next == boost::wave::T_COMMA ||
+                     next == boost::wave::T_RIGHTPAREN || next == boost::wave::T_LEFTBRACKET)) {
+                    names.push_back(value(i));
+                }
+            }
+            return names;
+        }
+
+        if (keyword == "using") {
+            if (is_identifier(k + 1) && token_id(k + 2) == boost::wave::T_ASSIGN) {
+                return {value(k + 1)};
+            }
+            return {};
+        }
+
+        if (keyword == "class" || keyword == "struct" || keyword == "union" || keyword == "enum") {
+            auto i = k + 1;
+            if (keyword == "enum" && (value(i) == "class" || value(i) == "struct")) {
+                ++i;
+            }
+            i = skip_attributes(i);
+            if (i == none) {
+                return {};
+            }
+            std::vector<std::string_view> names;
+            if (is_identifier(i)) {
+                names.push_back(value(i++));
+            }
+            if (token_id(i) == boost::wave::T_COLON_COLON) {
+                return {};  // A nested class defined out of line.
+            }
+            const auto body = find_open(i, boost::wave::T_LEFTBRACE);
+            if (token_id(i) == boost::wave::T_LESS) {
+                // A specialization is wanted wherever its arguments are.
+                for (auto j = i; j < body; ++j) {
+                    if (token_id(j) == boost::wave::T_COLON) {
+                        break;
+                    }
+                    if (is_identifier(j)) {
+                        names.push_back(value(j));
+                    }
+                }
+            }
+            if (find_open(i, boost::wave::T_LEFTPAREN) < body) {
+                return {};  // Declares a function or an object.
+            }
+            if (body == end) {
+                // A forward declaration, of a template specialization or with an enum's
+                // underlying type at most.
+                auto rest = i;
+                if (token_id(rest) == boost::wave::T_LESS) {
+                    rest = matching_angle(significant, rest);
+                    rest = rest == none ? end : rest + 1;
+                } else if (keyword == "enum" && token_id(rest) == boost::wave::T_COLON) {
+                    rest = end - 1;
+                }
+                return rest + 1 == end && token_id(rest) == boost::wave::T_SEMICOLON
+                           ? names
+                           : std::vector<std::string_view>();
+            }
+            const auto body_end = matching(significant, body);
+            if (body_end == none ||
+                !(body_end + 1 == end ||
+                  (body_end + 2 == end && token_id(end - 1) == boost::wave::T_SEMICOLON))) {
+                return {};  // Also declares objects of the type.
+            }
+            if (keyword == "enum") {
+                for (auto j = body + 1; j < body_end; ++j) {
+                    const auto before = token_id(j - 1);
+                    if (is_identifier(j) &&
+                        (before == boost::wave::T_LEFTBRACE || before == boost::wave::T_COMMA)) {
+                        names.push_back(value(j));
+                    }
+                    if (nesting(token_id(j)) > 0) {
+                        j = matching(significant, j);
+                        if (j == none) {
+                            return {};
+                        }
+                    }
+                }
+            }
+            return keyword != "enum" && names.empty() ? std::vector<std::string_view>() : names;
+        }
+
+        const auto body = find_open(k, boost::wave::T_LEFTBRACE);
+        const auto assign = find_open(k, boost::wave::T_ASSIGN);
+        const bool is_constexpr =
+            std::any_of(significant.begin() + k, significant.begin() + std::min(body, assign),
+                        [&](std::size_t i) { return tokens[i].value == "constexpr"; });
+        if (is_constexpr && token_id(end - 1) == boost::wave::T_SEMICOLON &&
+            (assign < body || (body < end && token_id(body - 1) == boost::wave::T_IDENTIFIER))) {
+            // A constexpr variable. Its initializer cannot have side effects.
+            auto i = std::min(assign, body) - 1;
+            while (i > k && token_id(i) == boost::wave::T_RIGHTBRACKET) {
+                int depth = 0;
+                for (; i > k; --i) {
+                    depth += nesting(token_id(i));
+                    if (depth == 0) {
+                        break;
+                    }
+                }
+                --i;
+            }
+            return is_identifier(i) ? std::vector{value(i)} : std::vector<std::string_view>();
+        }
+
+        // A function definition: name ( parameters ) qualifiers { body }
+        if (body == end || assign < body) {
+            return {};
+        }
+        const auto body_end = matching(significant, body);
+        if (body_end == none ||
+            !(body_end + 1 == end ||
+              (body_end + 2 == end && token_id(end - 1) == boost::wave::T_SEMICOLON))) {
+            return {};
+        }
+        const auto parameters = find_open(k, boost::wave::T_LEFTPAREN);
+        if (parameters >= body || parameters == k || !is_identifier(parameters - 1) ||
+            macro_names.contains(value(parameters - 1))) {
+            return {};
+        }
+        if (parameters - 1 > k) {
+            const auto before = token_id(parameters - 2);
+            if (before == boost::wave::T_COLON_COLON || before == boost::wave::T_COMPL) {
+                return {};  // A member defined out of line.
+            }
+        }
+        for (auto i = matching(significant, parameters) + 1; i < body; ++i) {
+            const auto qualifier = value(i);
+            if (qualifier == "->" || qualifier == "requires") {
+                break;
+            }
+            if (qualifier == "noexcept" || qualifier == "throw") {
+                if (token_id(i + 1) == boost::wave::T_LEFTPAREN) {
+                    i = matching(significant, i + 1);
+                }
+                continue;
+            }
+            if (qualifier != "const" && qualifier != "volatile" && qualifier != "override" &&
+                qualifier != "final" && qualifier != "&" && qualifier != "&&") {
+                return {};  // Not the shape of a function; perhaps an unexpanded macro.
+            }
+        }
+        return {value(parameters - 1)};
+    }
+
+    bool split(std::string& failure) {
+        int open_scopes = 0;
+        for (std::size_t i = 0; i < tokens.size();) {
+            const auto token_id = id(i);
+            if (is_blank(token_id) || token_id == boost::wave::T_SEMICOLON) {
+                ++i;
+                continue;
+            }
+            if (is_directive(tokens[i].id)) {
+                const auto last = directive_end(i);
+                add_directive(i, last);
+                i = last + 1;
+                continue;
+            }
+            if (token_id == boost::wave::T_RIGHTBRACE) {
+                if (open_scopes-- == 0) {
+                    failure = "unbalanced braces";
+                    return false;
+                }
+                ++i;
+                continue;
+            }
+            if (const auto brace = scope_opening(i)) {
+                ++open_scopes;
+                i = *brace + 1;
+                continue;
+            }
+            bool has_directive = false;
+            const auto last = declaration_end(i, has_directive);
+            if (last == none) {
+                failure = "unbalanced brackets";
+                return false;
+            }
+            if (!has_directive && !in_main(i, last)) {
+                std::vector<std::size_t> significant;
+                for (auto j = i; j <= last; ++j) {
+                    if (!is_blank(tokens[j].id)) {
+                        significant.push_back(j);
+                    }
+                }
+                auto names = declared_names(significant);
+                if (!names.empty()) {
+                    add_definition({.first = i, .last = last, .names = std::move(names)});
+                }
+            }
+            i = last + 1;
+        }
+        if (open_scopes != 0) {
+            failure = "unbalanced braces";
+            return false;
+        }
+        return true;
+    }
+
+    void reach(std::string_view name) {
+        if (reached.insert(name).second) {
+            pending.push_back(name);
+        }
+    }
+
+    void keep(definition& def) {
+        if (def.kept) {
+            return;
+        }
+        def.kept = true;
+        for (auto i = def.first; i <= def.last; ++i) {
+            if (is_name(tokens[i].id)) {
+                reach(tokens[i].value);
+            }
+        }
+        pastes_any_name = pastes_any_name || def.pastes_any_name;
+        for (const auto fragment : def.paste_fragments) {
+            for (const auto& [name, indices] : defined_by) {
+                if (name.contains(fragment)) {
+                    reach(name);
+                }
+            }
+        }
+    }
+
+    // Byte range a removed definition takes up, with the blank lines and unkept comments
+    // before it and the rest of its last line if nothing else is on them.
+    std::pair<std::size_t, std::size_t> removed_range(const definition& def) const {
+        auto begin = tokens[def.first].offset;
+        for (auto i = def.first; i-- > 0;) {
+            const auto& tok = tokens[i];
+            const auto token_id = BASE_TOKEN(tok.id);
+            if (tok.in_main || !is_blank(token_id) ||
+                ((token_id == boost::wave::T_CCOMMENT || token_id == boost::wave::T_CPPCOMMENT) &&
+                 kept_comments.matches(tok.value))) {
+                break;
+            }
+            if (tok.value.ends_with('\n')) {
+                begin = tok.offset + tok.value.size();
+            }
+        }
+        const auto& last = tokens[def.last];
+        auto end = last.offset + last.value.size();
+        for (auto i = def.last + 1; i < tokens.size(); ++i) {
+            const auto token_id = id(i);
+            if (token_id == boost::wave::T_NEWLINE) {
+                end = tokens[i].offset + tokens[i].value.size();
+            }
+            if (token_id != boost::wave::T_SPACE && token_id != boost::wave::T_SPACE2) {
+                break;
+            }
+        }
+        return {begin, end};
+    }
+
+   public:
+    std::size_t candidates = 0;
+    std::size_t removed = 0;
+
+    explicit shaking_pass(const keyword_matcher& kept) : kept_comments(kept) {}
+
+    bool shake(std::string_view output,
+               const std::vector<std::pair<std::size_t, std::size_t>>& main_ranges,
+               boost::wave::language_support language,
+               const std::vector<std::string>& predefined_macros, std::string& shaken,
+               std::string& failure) {
+        using lex_iterator_type =
+            boost::wave::cpplexer::lex_iterator<boost::wave::cpplexer::lex_token<>>;
+        text = output;
+        std::size_t offset = 0;
+        try {
+            const lex_iterator_type end;
+            for (lex_iterator_type it(text.data(), text.data() + text.size(),
+                                      boost::wave::util::file_position_type("<output>"), language);
+                 it != end && boost::wave::token_id(*it) != boost::wave::T_EOF; ++it) {
+                const auto& value = it->get_value();
+                const std::string_view lexed(value.data(), value.size());
+                if (text.compare(offset, lexed.size(), lexed) != 0) {
+                    failure = "the output does not lex back to itself";
+                    return false;
+                }
+                tokens.push_back({boost::wave::token_id(*it), text.substr(offset, lexed.size()),
+                                  offset});
+                offset += lexed.size();
+            }
+        } catch (const boost::wave::cpplexer::lexing_exception& e) {
+            failure = fmt::format("lexing error: {}", e.description());
+            return false;
+        }
+        if (offset != text.size()) {
+            failure = "the output does not lex back to itself";
+            return false;
+        }
+        auto range = main_ranges.begin();
+        for (auto& tok : tokens) {
+            while (range != main_ranges.end() && range->second <= tok.offset) {
+                ++range;
+            }
+            tok.in_main = range != main_ranges.end() && range->first <= tok.offset;
+        }
+
+        for (const auto& macro : predefined_macros) {
+            macro_names.insert(std::string_view(macro).substr(0, macro.find_first_of("=(")));
+        }
+        for (std::size_t i = 0; i < tokens.size(); ++i) {
+            if (id(i) == boost::wave::T_PP_DEFINE) {
+                const auto name = next_significant(i + 1, tokens.size() - 1);
+                if (name < tokens.size()) {
+                    macro_names.insert(tokens[name].value);
+                }
+            }
+        }
+        owners.assign(tokens.size(), none);
+        if (!split(failure)) {
+            return false;
+        }
+        candidates = definitions.size();
+
+        for (const auto name : implicit_names) {
+            reach(name);
+        }
+        for (std::size_t i = 0; i < tokens.size(); ++i) {
+            if (owners[i] == none && is_name(tokens[i].id)) {
+                reach(tokens[i].value);
+            }
+        }
+        while (!pending.empty()) {
+            const auto name = pending.back();
+            pending.pop_back();
+            if (const auto it = defined_by.find(name); it != defined_by.end()) {
+                for (const auto index : it->second) {
+                    keep(definitions[index]);
+                }
+            }
+        }
+        if (pastes_any_name) {
+            failure = "a reachable macro pastes identifiers from its arguments";
+            return false;
+        }
+
+        shaken.clear();
+        std::size_t copied = 0;
+        for (const auto& def : definitions) {
+            if (def.kept) {
+                continue;
+            }
+            const auto [begin, end] = removed_range(def);
+            shaken.append(text.substr(copied, begin - std::min(begin, copied)));
+            copied = std::max(copied, end);
+            ++removed;
+        }
+        shaken.append(text.substr(copied));
+        return true;
+    }
+};
+
+}  // namespace
+
+bool tree_shaker::shake(std::string_view output,
+                        const std::vector<std::pair<std::size_t, std::size_t>>& main_ranges,
+                        boost::wave::language_support language,
+                        const std::vector<std::string>& predefined_macros, std::string& shaken,
+                        std::string& failure) {
+    shaking_pass pass(kept_comments);
+    const bool success =
+        pass.shake(output, main_ranges, language, predefined_macros, shaken, failure);
+    candidates = pass.candidates;
+    removed = pass.removed;
+    return success;
+}
+
+}  // namespace cequip::internal
@@ -0,0 +1,56 @@
+# Runs cequip on INPUT from tests/in with OPTIONS and compares its output with EXPECTED.
+#
+# MODE is one of
+#   no-cache          a single run with --no-cache
+#   no-pass-through   a single run with --no-cache that lexes every line with Wave
+#   cached            a cold run filling a fresh cache in WORK_DIR and a warm run replaying
+#                     from it; the inputs in PRIME are preprocessed into that cache first
+# and every run has to reproduce EXPECTED byte for byte.
+
+cmake_minimum_required(VERSION 3.20)
+
+get_filename_component(input_dir "${CMAKE_CURRENT_LIST_DIR}/in" ABSOLUTE)
+# Read as hex, since file(READ) would drop the carriage returns of CRLF output.
+file(READ "${EXPECTED}" expected HEX)
+
+# Runs cequip with its output going to WORK_DIR/<run>.out, which is kept for inspection.
+function(run_cequip run input)
+    execute_process(
+        COMMAND "${CEQUIP}" -q "${input}" -i . ${OPTIONS} ${ARGN}
+        WORKING_DIRECTORY "${input_dir}"
+        OUTPUT_FILE "${WORK_DIR}/${run}.out"
+        ERROR_VARIABLE stderr
+        RESULT_VARIABLE result)
+    if(NOT result EQUAL 0)
+        message(FATAL_ERROR "cequip ${input} failed (${result}):\n${stderr}")
+    endif()
+endfunction()
+
+function(check_output run)
+    file(READ "${WORK_DIR}/${run}.out" actual HEX)
+    if(NOT actual STREQUAL expected)
+        message(FATAL_ERROR "${run} run of ${INPUT} differs from ${EXPECTED}, "
+                            "see ${WORK_DIR}/${run}.out")
+    endif()
+endfunction()
+
+file(REMOVE_RECURSE "${WORK_DIR}")
+file(MAKE_DIRECTORY "${WORK_DIR}")
+
+if(MODE STREQUAL "no-cache")
+    run_cequip(no-cache "${INPUT}" --no-cache)
+    check_output(no-cache)
+elseif(MODE STREQUAL "no-pass-through")
+    run_cequip(no-pass-through "${INPUT}" --no-cache --no-pass-through)
+    check_output(no-pass-through)
+elseif(MODE STREQUAL "cached")
+    foreach(prime IN LISTS PRIME)
+        run_cequip(prime "${prime}" --cache-dir "${WORK_DIR}/cache")
+    endforeach()
+    run_cequip(cold "${INPUT}" --cache-dir "${WORK_DIR}/cache")
+    check_output(cold)
+    run_cequip(warm "${INPUT}" --cache-dir "${WORK_DIR}/cache")
+    check_output(warm)
+else()
+    message(FATAL_ERROR "Unknown MODE: ${MODE}")
+endif()
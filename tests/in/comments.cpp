@@ -0,0 +1,8 @@
+#include "comments_lib.hpp"
+// A line comment on its own.
+
+int main() {
+    int a = 1, b = 2; // Ends a line.
+    int c = a+/* Splits a plus sign. */+b;
+    return c /* Trails. */;
+}
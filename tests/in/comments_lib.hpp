@@ -0,0 +1,8 @@
+#ifndef COMMENTS_LIB_HPP
+#define COMMENTS_LIB_HPP
+// A header passed through verbatim.
+int lib_sum(int a, int b); // Ends a line.
+
+int lib_pre/* Splits two tokens. */fix();
+/* TODO: Matched by --keep-comments-matching. */
+#endif
@@ -0,0 +1,14 @@
+#include "hoist_lib.hpp"
+#include "hoist_lib.hpp"
+#define int long long
+#include <string>
+#include <iostream>
+#include <cassert>
+
+std::string name();
+
+#include "hoist_config.hpp"
+#include <algorithm>
+#include <vector>
+
+signed main() { assert(read_all().empty()); }
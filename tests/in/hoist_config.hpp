@@ -0,0 +1,3 @@
+// A barrier in an included header, replayed from the cache on warm runs.
+#define NDEBUG
+#include <map>
@@ -0,0 +1,7 @@
+#ifndef _HOIST_LIB_HPP
+#define _HOIST_LIB_HPP
+// The include guard is reserved but is not a barrier.
+#include <vector>
+#include <iostream>
+std::vector<int> read_all();
+#endif
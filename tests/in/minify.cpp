@@ -0,0 +1,14 @@
+#define SUM    a   +   b
+#define SQUARE(x)   ( (x)  *  (x) )
+#define NEGATE(x)   - x
+#define STR(x)      #x
+
+/* Helpers */
+static int   square ( int   value )   {
+    return   SQUARE( value ) ;   // Squared.
+}
+
+int main ( ) {
+    int a = 1 , b = - - a ;
+    return square( a + + b ) - NEGATE( 1 ) + sizeof STR( a   b ) ;
+}
@@ -0,0 +1,5 @@
+#pragma once
+
+#include "once_b.hpp"
+
+int from_a();
@@ -0,0 +1,4 @@
+#include "once_b.hpp"
+#include "once_a.hpp"
+
+int main() { return from_a() + from_b(); }
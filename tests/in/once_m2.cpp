@@ -0,0 +1,3 @@
+#include "once_a.hpp"
+
+int main() { return from_a() + from_b(); }
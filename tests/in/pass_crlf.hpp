@@ -0,0 +1,4 @@
+// Included with CRLF line endings.
+inline int crlf_value() {
+    return 7;  // Seven.
+}
@@ -0,0 +1,26 @@
+#ifndef PASS_LIB_HPP
+#define PASS_LIB_HPP
+
+#define PASS_SCALE 2
+#define PASS_TWICE(x) ((x) * PASS_SCALE)
+
+// A region without any macro names passes through as it is.
+inline int plain(int value) {
+    /* Block comment
+       spanning lines. */
+    return value + 1;  // Trailing comment.
+}
+
+// Function-like macro called with a space before its arguments.
+inline int twice(int value) { return PASS_TWICE (value); }
+
+// Object-like macro followed by a '(' after a space, which Wave drops all the same.
+inline int grouped() { return PASS_SCALE (+1); }
+
+inline const char* text() { return "# not a directive"; }
+
+#if PASS_SCALE > 1
+inline int scaled() { return PASS_SCALE; }
+#endif
+
+#endif
@@ -0,0 +1,13 @@
+// Included twice, without a guard. The second time Wave looks into the region after #line
+// before it applies the #line, which has to hold for the lines after the region as well.
+#ifdef F
+#endif
+#define BAR(x) x
+#line 100
+BAR (x)
+#ifdef F
+#endif
+int __LINE__;
+#if defined(H) && H + 0 == 0
+#endif
+#define F(a,b) a+b
@@ -0,0 +1,6 @@
+#include "pass_lib.hpp"
+#include "pass_crlf.hpp"
+#include "pass_line.hpp"
+#include "pass_line.hpp"
+
+int main() { return plain(1) + twice(2) + scaled() + crlf_value() + (text() != nullptr); }
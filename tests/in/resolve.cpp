@@ -0,0 +1,9 @@
+#include "resolve/a/module.hpp"
+#include "resolve/b/module.hpp"
+#include "resolve/a/module.hpp"
+#include <shadow.hpp>
+#include <shadow.hpp>
+#include <not_found.hpp>
+#include <not_found.hpp>
+
+int main() { return module_a() + module_b() + shadow_first() + shadow_second(); }
@@ -0,0 +1,4 @@
+#ifndef RESOLVE_A_CONFIG_HPP
+#define RESOLVE_A_CONFIG_HPP
+int config_a();
+#endif
@@ -0,0 +1,4 @@
+// Finds the config.hpp next to it.
+#include "config.hpp"
+#include "config.hpp"
+int module_a();
@@ -0,0 +1,4 @@
+#ifndef RESOLVE_B_CONFIG_HPP
+#define RESOLVE_B_CONFIG_HPP
+int config_b();
+#endif
@@ -0,0 +1,3 @@
+// Finds the config.hpp next to it, not the one next to a/module.hpp.
+#include "config.hpp"
+int module_b();
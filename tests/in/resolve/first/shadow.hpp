@@ -0,0 +1,3 @@
+// Shadows second/shadow.hpp and includes it on top.
+int shadow_first();
+#include_next <shadow.hpp>
@@ -0,0 +1,6 @@
+#include "shake_lib.hpp"
+
+int main() {
+    shake::used_alias item{SHAKE_USED};
+    return shake::used(item.value) + shake::identity(0);
+}
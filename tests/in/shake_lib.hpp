@@ -0,0 +1,38 @@
+#pragma once
+
+#define SHAKE_USED 1
+#define SHAKE_UNUSED 2
+
+namespace shake {
+
+// Reached from main.
+inline int used(int value) { return value + helper_value; }
+
+// Not reached from anywhere.
+inline int unused(int value) { return value * 2; }
+
+constexpr int helper_value = 3;
+constexpr int unused_value = 4;
+
+struct used_type {
+    int value;
+};
+
+struct unused_type {
+    int value;
+};
+
+using used_alias = used_type;
+using unused_alias = unused_type;
+
+enum class unused_enum { a, b };
+
+template <typename T>
+T identity(T value) {
+    return value;
+}
+
+}  // namespace shake
+
+// Declarations are never removed.
+int declared_only();
@@ -0,0 +1,56 @@
+# Preprocesses test2.cpp for several configurations at once with --matrix, with --no-cache and
+# through a cold and a warm cache. Every output has to match the expected output of the same
+# configuration run on its own.
+
+cmake_minimum_required(VERSION 3.20)
+
+get_filename_component(input_dir "${CMAKE_CURRENT_LIST_DIR}/in" ABSOLUTE)
+get_filename_component(expected_dir "${CMAKE_CURRENT_LIST_DIR}/expected" ABSOLUTE)
+
+# Expected output name, then the options of its configuration.
+set(configurations
+    "test2|"
+    "test2_remove_comments|--remove-comments"
+    "test2_crlf|--end-of-line crlf"
+    "test2_minify|--minify")
+
+file(REMOVE_RECURSE "${WORK_DIR}")
+file(MAKE_DIRECTORY "${WORK_DIR}")
+set(matrix "")
+foreach(configuration IN LISTS configurations)
+    string(REPLACE "|" ";" fields "${configuration}")
+    list(GET fields 0 name)
+    list(GET fields 1 options)
+    string(APPEND matrix "\"${WORK_DIR}/${name}.out\" ${options}\n")
+endforeach()
+file(WRITE "${WORK_DIR}/matrix.txt" "${matrix}")
+
+function(run_matrix run)
+    file(GLOB outputs "${WORK_DIR}/*.out")
+    if(outputs)
+        file(REMOVE ${outputs})
+    endif()
+    execute_process(
+        COMMAND "${CEQUIP}" -q test2.cpp -i . --matrix "${WORK_DIR}/matrix.txt" ${ARGN}
+        WORKING_DIRECTORY "${input_dir}"
+        ERROR_VARIABLE stderr
+        RESULT_VARIABLE result)
+    if(NOT result EQUAL 0)
+        message(FATAL_ERROR "${run} matrix run failed (${result}):\n${stderr}")
+    endif()
+    foreach(configuration IN LISTS configurations)
+        string(REPLACE "|" ";" fields "${configuration}")
+        list(GET fields 0 name)
+        file(READ "${WORK_DIR}/${name}.out" actual HEX)
+        file(READ "${expected_dir}/${name}.out" expected HEX)
+        if(NOT actual STREQUAL expected)
+            file(RENAME "${WORK_DIR}/${name}.out" "${WORK_DIR}/${name}.${run}.out")
+            message(FATAL_ERROR "${run} matrix run differs from ${expected_dir}/${name}.out, "
+                                "see ${WORK_DIR}/${name}.${run}.out")
+        endif()
+    endforeach()
+endfunction()
+
+run_matrix(no-cache --no-cache)
+run_matrix(cold --cache-dir "${WORK_DIR}/cache")
+run_matrix(warm --cache-dir "${WORK_DIR}/cache")
@@ -0,0 +1,20 @@
+# Sends cequip serve a message with a length it does not accept and checks that it answers
+# with an error instead of trying to read that much.
+
+cmake_minimum_required(VERSION 3.20)
+
+file(REMOVE_RECURSE "${WORK_DIR}")
+file(MAKE_DIRECTORY "${WORK_DIR}")
+
+foreach(length 10737418239 99999999999999999999999 12x)
+    file(WRITE "${WORK_DIR}/request" "${length}\n{}")
+    execute_process(
+        COMMAND "${CEQUIP}" serve
+        INPUT_FILE "${WORK_DIR}/request"
+        OUTPUT_VARIABLE answer
+        ERROR_QUIET
+        RESULT_VARIABLE result)
+    if(NOT result EQUAL 0 OR NOT answer MATCHES "\"success\": false, \"diagnostics\"")
+        message(FATAL_ERROR "Length ${length} was not rejected (${result}):\n${answer}")
+    endif()
+endforeach()
@@ -0,0 +1,52 @@
+# Checks that the header cache notices a header added in front of one it was recorded with: a
+# nested include found in the second include path has to be found in the first one as soon as a
+# file of that name appears there, just as a run with --no-cache finds it.
+
+cmake_minimum_required(VERSION 3.20)
+
+# Runs cequip on main.cpp in dir, with the output going to the variable output.
+function(run_in dir)
+    execute_process(
+        COMMAND "${CEQUIP}" main.cpp -q -i d1 -i d2 ${ARGN}
+        WORKING_DIRECTORY "${dir}"
+        OUTPUT_VARIABLE out
+        ERROR_VARIABLE error
+        RESULT_VARIABLE result)
+    if(NOT result EQUAL 0)
+        message(FATAL_ERROR "cequip ${ARGN} failed (${result}):\n${error}")
+    endif()
+    set(output "${out}" PARENT_SCOPE)
+endfunction()
+
+function(check_run dir run expected)
+    run_in("${dir}" --cache-dir cache ${MODE_OPTIONS})
+    string(FIND "${output}" "${expected}" found)
+    if(found EQUAL -1)
+        message(FATAL_ERROR "${run} run did not write ${expected}:\n${output}")
+    endif()
+    set(cached "${output}")
+    run_in("${dir}" --no-cache ${MODE_OPTIONS})
+    if(NOT cached STREQUAL output)
+        message(FATAL_ERROR "${run} run wrote\n${cached}\ninstead of\n${output}")
+    endif()
+endfunction()
+
+file(REMOVE_RECURSE "${WORK_DIR}")
+foreach(mode pass-through no-pass-through)
+    set(dir "${WORK_DIR}/${mode}")
+    if(mode STREQUAL "no-pass-through")
+        set(MODE_OPTIONS --no-pass-through)
+    else()
+        set(MODE_OPTIONS)
+    endif()
+    file(WRITE "${dir}/main.cpp" "#include \"a.hpp\"\nint main_file;\n")
+    file(WRITE "${dir}/a.hpp" "#include <b.hpp>\nint a;\n")
+    file(WRITE "${dir}/d2/b.hpp" "int b_from_d2;\n")
+    file(MAKE_DIRECTORY "${dir}/d1")
+
+    check_run("${dir}" first b_from_d2)
+    check_run("${dir}" unchanged b_from_d2)
+    file(WRITE "${dir}/d1/b.hpp" "int b_from_d1;\n")
+    check_run("${dir}" shadowed b_from_d1)
+    check_run("${dir}" shadowed_again b_from_d1)
+endforeach()
@@ -0,0 +1,104 @@
+# Checks the up-to-date fast path of an output written to a file: a run with nothing changed
+# leaves it alone, a run after a header changed preprocesses it again. Every run, skipped or
+# not, has to leave the same output and depfile as a run with --no-cache, with and without
+# --no-pass-through. A header added in front of one the output was built from puts the output out
+# of date as well.
+
+cmake_minimum_required(VERSION 3.20)
+
+# Runs cequip on INPUT with INCLUDE_OPTIONS in dir, with its log going to the variable log.
+function(run_in dir output)
+    execute_process(
+        COMMAND "${CEQUIP}" ${INPUT} ${INCLUDE_OPTIONS} -o ${output} ${ARGN}
+        WORKING_DIRECTORY "${dir}"
+        OUTPUT_VARIABLE out
+        ERROR_VARIABLE out
+        RESULT_VARIABLE result)
+    if(NOT result EQUAL 0)
+        message(FATAL_ERROR "cequip ${ARGN} failed (${result}):\n${out}")
+    endif()
+    set(log "${out}" PARENT_SCOPE)
+endfunction()
+
+# Compares two files byte for byte; file(READ) without HEX would drop carriage returns.
+function(check_same actual expected)
+    file(READ "${actual}" actual_bytes HEX)
+    file(READ "${expected}" expected_bytes HEX)
+    if(NOT actual_bytes STREQUAL expected_bytes)
+        message(FATAL_ERROR "${actual} differs from ${expected}")
+    endif()
+endfunction()
+
+function(run_cequip dir run expect_up_to_date)
+    run_in("${dir}" out.cpp --cache-dir cache --depfile out.d ${MODE_OPTIONS})
+    string(FIND "${log}" "Up to date: out.cpp" found)
+    if(expect_up_to_date AND found EQUAL -1)
+        message(FATAL_ERROR "${run} run preprocessed an output that was up to date:\n${log}")
+    elseif(NOT expect_up_to_date AND NOT found EQUAL -1)
+        message(FATAL_ERROR "${run} run kept an output that was out of date:\n${log}")
+    endif()
+    # Written outside of dir, as a new file there would put out.cpp out of date.
+    run_in("${dir}" "${dir}-reference.cpp" -q --no-cache --depfile "${dir}-reference.d"
+           ${MODE_OPTIONS})
+    check_same("${dir}/out.cpp" "${dir}-reference.cpp")
+    # The rules only differ in their targets.
+    file(READ "${dir}/out.d" depfile)
+    file(READ "${dir}-reference.d" reference)
+    string(REPLACE "${dir}-reference.cpp:" "out.cpp:" reference "${reference}")
+    if(NOT depfile STREQUAL reference)
+        message(FATAL_ERROR "${run} run wrote the depfile\n${depfile}\ninstead of\n${reference}")
+    endif()
+    foreach(header ${HEADERS})
+        string(FIND "${depfile}" "${header}" found)
+        if(found EQUAL -1)
+            message(FATAL_ERROR "${run} run left ${header} out of the depfile:\n${depfile}")
+        endif()
+    endforeach()
+endfunction()
+
+file(REMOVE_RECURSE "${WORK_DIR}")
+foreach(mode pass-through no-pass-through)
+    set(dir "${WORK_DIR}/${mode}")
+    if(mode STREQUAL "no-pass-through")
+        set(MODE_OPTIONS --no-pass-through)
+    else()
+        set(MODE_OPTIONS)
+    endif()
+    set(INPUT once_m1.cpp)
+    set(INCLUDE_OPTIONS -i .)
+    set(HEADERS once_a.hpp once_b.hpp)
+    file(COPY "${CMAKE_CURRENT_LIST_DIR}/in/once_a.hpp" "${CMAKE_CURRENT_LIST_DIR}/in/once_b.hpp"
+              "${CMAKE_CURRENT_LIST_DIR}/in/once_m1.cpp"
+         DESTINATION "${dir}")
+
+    run_cequip("${dir}" first FALSE)
+    run_cequip("${dir}" unchanged TRUE)
+    file(APPEND "${dir}/once_b.hpp" "int changed_b();\n")
+    run_cequip("${dir}" changed FALSE)
+    file(READ "${dir}/out.cpp" output)
+    string(FIND "${output}" "int changed_b();" found)
+    if(found EQUAL -1)
+        message(FATAL_ERROR "Output misses the change to once_b.hpp:\n${output}")
+    endif()
+    run_cequip("${dir}" unchanged_again TRUE)
+
+    # <sub/b.hpp> is found in d2/sub, after a d1/sub without it.
+    set(dir "${WORK_DIR}/${mode}-shadowed")
+    set(INPUT main.cpp)
+    set(INCLUDE_OPTIONS -i d1 -i d2)
+    set(HEADERS sub/b.hpp)
+    file(WRITE "${dir}/main.cpp" "#include <sub/b.hpp>\nint main_file;\n")
+    file(WRITE "${dir}/d2/sub/b.hpp" "int b_from_d2;\n")
+    file(MAKE_DIRECTORY "${dir}/d1/sub")
+
+    run_cequip("${dir}" first FALSE)
+    run_cequip("${dir}" unchanged TRUE)
+    file(WRITE "${dir}/d1/sub/b.hpp" "int b_from_d1;\n")
+    run_cequip("${dir}" shadowed FALSE)
+    file(READ "${dir}/out.cpp" output)
+    string(FIND "${output}" "int b_from_d1;" found)
+    if(found EQUAL -1)
+        message(FATAL_ERROR "Output misses the header added to d1/sub:\n${output}")
+    endif()
+    run_cequip("${dir}" unchanged_again TRUE)
+endforeach()